@@ -0,0 +1,27 @@
+#!/bin/bash
+# Every allocation of each stage of the reference engine, per --arena mode,
+# from the "[alloc]" lines of a build configured with allocation counters:
+#   meson setup ../build_alloc -Dalloc_counters=true && meson compile -C ../build_alloc
+# The sampled call sites ("[alloc-site]" lines) are kept in a log alongside.
+
+tmp="../../tmp"
+build="${BUILD:-../build_alloc}"
+
+outfile="$(date -I)_$(hostname)_benchmark_alloc.csv"
+sitefile="$(date -I)_$(hostname)_benchmark_alloc_sites.log"
+
+mkdir -p $tmp
+rm $tmp/*
+
+echo L,arena,stage,allocations,bytes,peak_live > $outfile
+: > $sitefile
+for L in 4 8 12 16 20; do
+    for arena in none monotonic huge; do
+        $build/dmnd_dilute $L 0 0 0 $L 0 0 0 $L -p 0.1 -o $tmp --seed 2bd1dde03c3db836 -n 2 4 -f -v 1 --arena $arena \
+            | tee >(grep '^\[alloc-site\]' | sed "s/^/L=$L arena=$arena /" >> $sitefile) \
+            | sed -n 's/^\[alloc\] \(.*\): \(.*\) allocations, \(.*\) B, \(.*\) B peak live$/\1,\2,\3,\4/p' \
+            | while read line; do
+                echo $L,$arena,$line | tee -a $outfile
+            done
+    done
+done
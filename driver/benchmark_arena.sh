@@ -0,0 +1,21 @@
+#!/bin/bash
+# Time and container allocations of each stage of the reference engine, per
+# --arena mode, from the "[stage]" lines printed at verbosity 1.
+
+tmp="../../tmp"
+
+outfile="$(date -I)_$(hostname)_benchmark_arena.csv"
+
+mkdir -p $tmp
+rm $tmp/*
+
+echo L,arena,stage,runtime,allocations,bytes > $outfile
+for L in 4 8 12 16 20; do
+    for arena in none monotonic huge; do
+        ../build/dmnd_dilute $L 0 0 0 $L 0 0 0 $L -p 0.1 -o $tmp --seed 2bd1dde03c3db836 -n 2 4 -f -v 1 --arena $arena \
+            | sed -n 's/^\[stage\] \(.*\): \(.*\) s, \(.*\) allocations, \(.*\) B$/\1,\2,\3,\4/p' \
+            | while read line; do
+                echo $L,$arena,$line | tee -a $outfile
+            done
+    done
+done
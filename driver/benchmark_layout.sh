@@ -0,0 +1,24 @@
+#!/bin/bash
+# Runtime of the implicit engine per cell layout: row-major (block 0) and
+# tiles of 8^3 primitive cells. Outputs are identical for every layout.
+
+tmp="../../tmp"
+
+outfile="$(date -I)_$(hostname)_benchmark_layout.csv"
+
+mkdir -p $tmp
+rm $tmp/*
+
+echo L,N,block,runtime > $outfile
+for L in `seq 16 16 160`; do
+    for block in 0 8; do
+        start=`perl -MTime::HiRes=time -e 'printf "%.9f\n", time'`
+
+        ../build/dmnd_dilute $L 0 0 0 $L 0 0 0 $L -p 0.25 -o $tmp --seed 2bd1dde03c3db836 --engine implicit --block $block -f >/dev/null
+
+        end=`perl -MTime::HiRes=time -e 'printf "%.9f\n", time'`
+        runtime=$( echo "$end - $start" | bc -l )
+        echo $L $block $runtime
+        echo $L,$(( L*L*L )),$block,$runtime >> $outfile
+    done
+done
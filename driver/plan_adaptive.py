@@ -0,0 +1,287 @@
+#!/usr/bin/env python3
+"""
+Plans the next round of an adaptive sweep of dmnd_dilute over p.
+
+Each invocation reads what is known so far (the runs in db_repo, any
+databases given with --db, and the ledger of runs already planned) and
+prints the dmnd_dilute commands of the next round, in the format of
+plan_phase_dia.py, so they can be run with execute_asynchronous.sh or
+submit_array.sh. Rerunning it is how a sweep resumes; it prints nothing
+once every point is converged.
+
+For every L, a point p gets seeds until the standard error of the
+wrapping probability Pi(p) is below --tol (or it has --max_seeds), and a
+new point is placed halfway between neighbours whose Pi differ by more
+than --max_jump plus their combined error, down to a spacing of --dp_min. Points far from p_c, where
+Pi is 0 or 1, converge after a few dozen seeds; the budget of each round
+goes first to the largest jumps and errors.
+"""
+import os
+import sys
+import json
+import math
+import secrets
+import sqlite3
+import argparse
+import numpy as np
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'scripts'))
+from merge_to_sql import list_runs
+
+
+def eprint(*args, **kwargs):
+    print(*args, file=sys.stderr, **kwargs)
+
+
+# Points are keyed by p as it appears in statfile names: 4 decimals, and
+# halved for Zr4 (pZr), see dmnd_dilute
+def p_key(p):
+    return round(p, 4)
+
+
+# dmnd_dilute names seeds without leading zeros
+def seed_key(seed):
+    return format(int(seed, 16), 'x')
+
+
+def same_nn(nn_str, nn):
+    got = sorted(int(x) for x in nn_str.split(',') if x)
+    return got == sorted(nn)
+
+
+class Point:
+    def __init__(self, p):
+        self.p = p
+        self.seeds = set()
+        self.n_wrap = 0
+        self.pending = set()
+
+    @property
+    def n(self):
+        return len(self.seeds)
+
+    @property
+    def n_planned(self):
+        return len(self.seeds | self.pending)
+
+    # Jeffreys estimate, never exactly 0 or 1, so a point with no
+    # wrapping seeds still has an error that shrinks like 1/n
+    @property
+    def Pi(self):
+        return (self.n_wrap + 0.5) / (self.n + 1)
+
+    @property
+    def var(self):
+        return self.Pi * (1 - self.Pi)
+
+    @property
+    def se(self):
+        return math.sqrt(self.var / max(self.n, 1))
+
+
+class Sweep:
+    """Everything known about one (L, nn, cascade, strategy) sweep"""
+    def __init__(self, args):
+        self.args = args
+        self.points = {L: {} for L in args.L}
+
+    def point(self, L, p):
+        return self.points[L].setdefault(p_key(p), Point(p_key(p)))
+
+    # the L of a run, or None if it belongs to another sweep
+    def match(self, Z1, Z2, Z3, nn, cascade, strategy):
+        if strategy != self.args.strategy_table or cascade != self.args.cascade:
+            return None
+        if not same_nn(nn, self.args.delete_nn):
+            return None
+        L = int(Z1.split(',')[0])
+        if L not in self.points or (Z1, Z2, Z3) != (f"{L},0,0", f"0,{L},0", f"0,0,{L}"):
+            return None
+        return L
+
+    def add_result(self, L, p, seed, wraps):
+        pt = self.point(L, p)
+        seed = seed_key(seed)
+        if seed in pt.seeds:
+            return
+        pt.seeds.add(seed)
+        pt.n_wrap += bool(wraps)
+
+
+def scan_statfiles(sweep, db_repo, observable):
+    for path, meta in list_runs(db_repo):
+        L = sweep.match(meta['Z1'], meta['Z2'], meta['Z3'], meta['nn'],
+                        meta['cascade'], meta['table'])
+        if L is None:
+            continue
+        try:
+            with open(os.path.join(db_repo, path)) as f:
+                wraps = json.load(f)['percolation'][observable]
+        except (OSError, ValueError, KeyError):
+            continue
+        sweep.add_result(L, meta['p'], meta['seed'], wraps)
+
+
+def scan_database(sweep, db_path, observable):
+    conn = sqlite3.connect(db_path)
+    table = sweep.args.strategy_table
+    # runs merged before --cascade existed did not use it
+    columns = {row[1] for row in conn.execute(f"PRAGMA table_info({table})")}
+    cascade = 'cascade' if 'cascade' in columns else '0'
+    rows = conn.execute(
+        f"SELECT Z1, Z2, Z3, nn, {cascade}, p, seed, {observable} FROM {table}")
+    for Z1, Z2, Z3, nn, cascade, p, seed, wraps in rows:
+        L = sweep.match(Z1, Z2, Z3, nn, bool(cascade), table)
+        if L is not None and wraps is not None:
+            sweep.add_result(L, p, seed, wraps)
+    conn.close()
+
+
+def read_ledger(sweep, path):
+    if not os.path.exists(path):
+        return
+    with open(path) as f:
+        for line in f:
+            run = json.loads(line)
+            if sweep.match(*run['Z'], run['nn'], run['cascade'], run['table']) is None:
+                continue
+            sweep.point(run['L'], run['p']).pending.add(seed_key(run['seed']))
+
+
+def plan(sweep):
+    """
+    The next round as a list of (priority, L, p, n_seeds), most urgent
+    first.
+    """
+    args = sweep.args
+    requests = []
+    for L, points in sweep.points.items():
+        p0, dp, p1 = args.prob_range
+        for p in np.arange(p0, p1 + 0.5*dp, dp):
+            sweep.point(L, p / args.scale)
+
+        # seeds for points that are not yet converged
+        for pt in points.values():
+            if pt.n_planned < args.min_seeds:
+                requests.append((math.inf, L, pt.p, args.min_seeds - pt.n_planned))
+            elif pt.se > args.tol and pt.n_planned < args.max_seeds and pt.n >= args.min_seeds:
+                needed = min(math.ceil(pt.var / args.tol**2), args.max_seeds)
+                n_new = min(needed - pt.n_planned, args.batch)
+                if n_new > 0:
+                    requests.append((pt.se / args.tol, L, pt.p, n_new))
+
+        # new points across the largest jumps of Pi
+        ordered = sorted(points.values(), key=lambda pt: pt.p)
+        for a, b in zip(ordered, ordered[1:]):
+            if a.n < args.min_seeds or b.n < args.min_seeds:
+                continue
+            # only jumps that exceed max_jump by more than their error
+            jump = abs(b.Pi - a.Pi) - math.sqrt(a.se**2 + b.se**2)
+            mid = p_key(0.5 * (a.p + b.p))
+            if jump > args.max_jump and b.p - a.p >= 2 * args.dp_min / args.scale and mid not in points:
+                # ranked above any error, below unseeded points
+                requests.append((1e6 * jump, L, mid, args.min_seeds))
+
+    requests.sort(key=lambda r: -r[0])
+    return requests
+
+
+def print_status(sweep):
+    for L, points in sweep.points.items():
+        eprint(f"L={L}")
+        for pt in sorted(points.values(), key=lambda pt: pt.p):
+            flag = "" if pt.se <= sweep.args.tol or pt.n_planned >= sweep.args.max_seeds else " *"
+            pend = f" (+{pt.n_planned - pt.n} pending)" if pt.n_planned > pt.n else ""
+            eprint(f"  p={pt.p * sweep.args.scale:.4f}  n={pt.n:5d}{pend}  Pi={pt.Pi:.3f} +- {pt.se:.3f}{flag}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Plan the next round of an adaptive p sweep')
+    parser.add_argument('db_repo', type=str, help='Directory dmnd_dilute writes statfiles to')
+    parser.add_argument('-L', '--L', nargs='+', type=int, required=True,
+                        help='Linear sizes, for L 0 0 0 L 0 0 0 L supercells')
+    parser.add_argument('-P', '--prob_range', nargs=3, type=float, default=[0.0, 0.02, 0.2],
+                        metavar=('START', 'STEP', 'STOP'),
+                        help='Initial coarse grid of p, inclusive of both terminals')
+    parser.add_argument('-n', '--delete_nn', nargs='+', type=int, default=[],
+                        help='Path lengths to excise, as dmnd_dilute -n')
+    parser.add_argument('--cascade', action='store_true', help='Pass --cascade to dmnd_dilute')
+    parser.add_argument('-y', '--strategy', choices=['random', 'Zr4'], default='random')
+    parser.add_argument('--aux', type=str, default="",
+                        help='Further dmnd_dilute arguments that do not change the statfile name')
+    parser.add_argument('--observable', default='links_wrap',
+                        choices=['links_wrap', 'plaqs_wrap', 'vols_wrap'])
+    parser.add_argument('--tol', type=float, default=0.02,
+                        help='Target standard error of the wrapping probability')
+    parser.add_argument('--min_seeds', type=int, default=16,
+                        help='Seeds a point gets before its error is trusted')
+    parser.add_argument('--max_seeds', type=int, default=4000, help='Seeds a point gets at most')
+    parser.add_argument('--batch', type=int, default=200,
+                        help='Seeds added to one point per round at most')
+    parser.add_argument('--max_jump', type=float, default=0.1,
+                        help='Largest change of Pi tolerated between neighbouring points')
+    parser.add_argument('--dp_min', type=float, default=0.001, help='Finest spacing of p')
+    parser.add_argument('--max_jobs', type=int, default=10000, help='Commands per round at most')
+    parser.add_argument('--db', nargs='*', default=[],
+                        help='Databases of merge_to_sql.py holding earlier results')
+    parser.add_argument('--ledger', type=str, default=None,
+                        help='Record of planned runs (default: <db_repo>/adaptive_ledger.jsonl)')
+    parser.add_argument('--forget_pending', action='store_true',
+                        help='Treat planned runs without a statfile as failed, and plan them again')
+    args = parser.parse_args()
+    args.strategy_table = 'stats_random' if args.strategy == 'random' else 'stats_Zr'
+    args.scale = 1 if args.strategy == 'random' else 2
+    ledger = args.ledger or os.path.join(args.db_repo, 'adaptive_ledger.jsonl')
+
+    if not os.path.isdir(args.db_repo):
+        os.makedirs(args.db_repo, exist_ok=True)
+        eprint("Making directories, " + args.db_repo)
+
+    sweep = Sweep(args)
+    scan_statfiles(sweep, args.db_repo, args.observable)
+    for db in args.db:
+        scan_database(sweep, db, args.observable)
+    if not args.forget_pending:
+        read_ledger(sweep, ledger)
+
+    requests = plan(sweep)
+    print_status(sweep)
+
+    nn_args = ("-n " + " ".join(map(str, args.delete_nn))) if args.delete_nn else ""
+    n_jobs = 0
+    with open(ledger, 'a') as led:
+        for _, L, p, count in requests:
+            count = min(count, args.max_jobs - n_jobs)
+            for _ in range(count):
+                seed = secrets.token_hex(4)
+                cmd = f"build/dmnd_dilute {L} 0 0 0 {L} 0 0 0 {L} -p {p * args.scale:.4f} -o {args.db_repo} --seed {seed}"
+                if args.strategy != 'random':
+                    cmd += f" -y {args.strategy}"
+                if nn_args:
+                    cmd += f" {nn_args}"
+                if args.cascade:
+                    cmd += " --cascade"
+                if args.aux:
+                    cmd += f" {args.aux}"
+                print(cmd)
+
+                Z = (f"{L},0,0", f"0,{L},0", f"0,0,{L}")
+                led.write(json.dumps({'Z': Z, 'L': L, 'p': p, 'seed': seed,
+                                      'nn': ",".join(map(str, args.delete_nn)),
+                                      'cascade': args.cascade,
+                                      'table': args.strategy_table}) + "\n")
+            n_jobs += count
+            if n_jobs >= args.max_jobs:
+                break
+
+    n_pending = sum(pt.n_planned - pt.n for points in sweep.points.values() for pt in points.values())
+    if n_jobs:
+        eprint(f"{n_jobs} runs planned")
+    elif n_pending:
+        eprint(f"Waiting for {n_pending} planned runs (--forget_pending if they failed)")
+    else:
+        eprint("All points converged")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,159 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <cxxabi.h>
+#include <execinfo.h>
+
+/**
+ * Counts of every allocation made through global operator new, for builds
+ * configured with -Dalloc_counters=true. Those link src/alloc_counting.cpp,
+ * which replaces operator new/delete with versions that report here, and
+ * define DMND_ALLOC_COUNTERS so that stage_timer prints an "[alloc]" line
+ * per stage. Unlike the arena's counts, these cover latticelab's cells and
+ * chains, std::set and nlohmann::json as well as the pmr containers.
+ *
+ * Every sample_period-th allocation of a thread records its call stack, so
+ * that the busiest call sites of a stage can be listed (report_sites).
+ * Allocations made while recording, or by the report itself, are not
+ * counted.
+ */
+
+namespace alloc_counters {
+
+inline std::atomic<uint64_t> n_allocations{0};
+inline std::atomic<uint64_t> n_bytes{0};
+inline std::atomic<uint64_t> live{0};       // bytes allocated and not yet freed
+inline std::atomic<uint64_t> peak_live{0};  // most live bytes since reset_peak
+
+constexpr unsigned sample_period = 64;
+constexpr int max_frames = 8;
+
+// Set while this thread is inside the counters, whose own allocations
+// must not be counted (or recurse)
+inline thread_local bool in_hook = false;
+
+struct hook_guard {
+    bool prev;
+    hook_guard() : prev(in_hook) { in_hook = true; }
+    ~hook_guard(){ in_hook = prev; }
+};
+
+struct site_stats {
+    uint64_t n_samples = 0;
+    uint64_t n_bytes = 0;
+};
+
+inline std::mutex sites_mutex;
+
+// Sampled call stacks, innermost frame (the caller of operator new) first
+inline std::map<std::vector<void*>, site_stats>& sites(){
+    static std::map<std::vector<void*>, site_stats> s;
+    return s;
+}
+
+// Called by operator new; not inlined, so that the frames to skip are
+// always this one and operator new's
+[[gnu::noinline]] inline void on_alloc(size_t bytes){
+    n_allocations.fetch_add(1, std::memory_order_relaxed);
+    n_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    const auto now = live.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    auto peak = peak_live.load(std::memory_order_relaxed);
+    while (now > peak && !peak_live.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {}
+
+    thread_local unsigned countdown = sample_period;
+    if (--countdown != 0) return;
+    countdown = sample_period;
+
+    hook_guard g;
+    void* frames[max_frames + 2];
+    int n = backtrace(frames, max_frames + 2);
+    if (n <= 2) return;
+    std::vector<void*> key(frames + 2, frames + n);
+    std::lock_guard<std::mutex> lock(sites_mutex);
+    auto& s = sites()[key];
+    s.n_samples++;
+    s.n_bytes += bytes;
+}
+
+inline void on_free(size_t bytes){
+    live.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+inline void reset_peak(){
+    peak_live.store(live.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+// A demangled name with template and function arguments elided, which
+// would otherwise run to pages for nlohmann::json
+inline std::string elide_arguments(const std::string& name){
+    std::string res;
+    int depth = 0;
+    for (char ch : name){
+        if (ch == '<' || ch == '('){
+            if (depth++ == 0) res += ch;
+        } else if (ch == '>' || ch == ')'){
+            if (depth == 0 || --depth == 0) res += ch;
+        } else if (depth == 0){
+            res += ch;
+        }
+    }
+    return res;
+}
+
+// A frame as its function (demangled where possible), or its address
+inline std::string describe(char* symbol){
+    std::string s(symbol);
+    auto open = s.find('('), plus = s.find('+', open);
+    if (open == std::string::npos || plus == std::string::npos || plus == open + 1){
+        return s;
+    }
+    std::string mangled = s.substr(open + 1, plus - open - 1);
+    int status = 0;
+    char* name = abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status);
+    std::string res = status == 0 ? elide_arguments(name) : mangled;
+    free(name);
+    return res;
+}
+
+/**
+ * Prints the 'top' call sites sampled since the last report, most
+ * allocations first, as
+ * "[alloc-site] <stage>: ~<allocations> allocations, ~<bytes> B: <caller> < <its caller> < ..."
+ * (counts are samples scaled by sample_period), then forgets them.
+ */
+inline void report_sites(const char* stage, size_t top=5, int depth=4){
+    hook_guard g;
+    std::lock_guard<std::mutex> lock(sites_mutex);
+    std::vector<std::pair<const std::vector<void*>*, site_stats>> ranked;
+    for (const auto& [frames, s] : sites()) ranked.push_back({&frames, s});
+    std::sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b){
+        return a.second.n_samples > b.second.n_samples;
+    });
+
+    for (size_t i=0; i<std::min(top, ranked.size()); i++){
+        const auto& frames = *ranked[i].first;
+        int n = std::min<int>(depth, frames.size());
+        char** symbols = backtrace_symbols(frames.data(), n);
+        std::string where;
+        for (int k=0; k<n; k++){
+            if (k) where += " < ";
+            where += symbols ? describe(symbols[k]) : "?";
+        }
+        free(symbols);
+        printf("[alloc-site] %s: ~%lu allocations, ~%lu B: %s\n", stage,
+                (unsigned long)(ranked[i].second.n_samples * sample_period),
+                (unsigned long)(ranked[i].second.n_bytes * sample_period),
+                where.c_str());
+    }
+    sites().clear();
+}
+
+} // end namespace alloc_counters
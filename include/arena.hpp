@@ -0,0 +1,207 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory_resource>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+#include <sys/mman.h>
+
+#include "perf_counters.hpp"
+#ifdef DMND_ALLOC_COUNTERS
+#include "alloc_counters.hpp"
+#endif
+
+/**
+ * Per-realisation memory for the containers of the dilution pipeline.
+ *
+ * Installing a realisation_arena makes it the default std::pmr resource, so
+ * every std::pmr container default-constructed during the realisation
+ * allocates from one monotonic buffer, optionally on transparent huge
+ * pages. Deallocation is a no-op; everything is released at once when the
+ * arena goes out of scope. Cells and chains belong to latticelab and keep
+ * using the global heap.
+ */
+
+namespace arena {
+
+// Page-aligned chunks from mmap, with the kernel asked to back them by
+// transparent huge pages
+class huge_page_resource : public std::pmr::memory_resource {
+public:
+    static constexpr size_t huge_page = size_t(1) << 21;
+
+private:
+    void* do_allocate(size_t bytes, size_t) override {
+        bytes = (bytes + huge_page - 1) & ~(huge_page - 1);
+        void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+        madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+        return p;
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t) override {
+        bytes = (bytes + huge_page - 1) & ~(huge_page - 1);
+        munmap(p, bytes);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+
+// Forwards to upstream, counting what passes through
+class counting_resource : public std::pmr::memory_resource {
+public:
+    explicit counting_resource(std::pmr::memory_resource* upstream) : upstream(upstream) {}
+
+    uint64_t n_allocations = 0;
+    uint64_t n_bytes = 0;
+
+private:
+    std::pmr::memory_resource* upstream;
+
+    void* do_allocate(size_t bytes, size_t align) override {
+        n_allocations++;
+        n_bytes += bytes;
+        return upstream->allocate(bytes, align);
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t align) override {
+        upstream->deallocate(p, bytes, align);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+
+/**
+ * The default std::pmr resource for as long as it lives.
+ * @param mode: "none" (the global heap, only counted), "monotonic", or
+ *              "huge" (monotonic, on huge pages)
+ */
+class realisation_arena {
+public:
+    explicit realisation_arena(const std::string& mode) : counter(upstream_for(mode)) {
+        previous = std::pmr::set_default_resource(&counter);
+    }
+
+    ~realisation_arena(){
+        std::pmr::set_default_resource(previous);
+    }
+
+    realisation_arena(const realisation_arena&) = delete;
+    realisation_arena& operator=(const realisation_arena&) = delete;
+
+    inline const counting_resource& counts() const { return counter; }
+
+private:
+    // declared in construction order: counter depends on pool, pool on huge
+    std::optional<huge_page_resource> huge;
+    std::optional<std::pmr::monotonic_buffer_resource> pool;
+    counting_resource counter;
+    std::pmr::memory_resource* previous = nullptr;
+
+    static constexpr size_t initial_size = size_t(1) << 24;
+
+    std::pmr::memory_resource* upstream_for(const std::string& mode){
+        if (mode == "none") return std::pmr::new_delete_resource();
+        if (mode == "huge"){
+            huge.emplace();
+            pool.emplace(initial_size, &*huge);
+        } else if (mode == "monotonic"){
+            pool.emplace(initial_size);
+        } else {
+            throw std::invalid_argument("Unknown arena mode "+mode);
+        }
+        return &*pool;
+    }
+};
+
+
+// Wall time and arena allocations of consecutive stages, printed as
+// "[stage] <name>: <seconds> s, <allocations> allocations, <bytes> B"
+// (without an arena, only the time), and with 'perf' the hardware counters
+// of each stage, per cell of the n_cells it visited (see perf_counters.hpp).
+// Builds with allocation counters add every operator new of the stage as
+// "[alloc] <name>: <allocations> allocations, <bytes> B, <bytes> B peak live"
+// and its busiest call sites (see alloc_counters.hpp).
+class stage_timer {
+public:
+    stage_timer(const realisation_arena& a, bool enabled,
+            const perf_counters::counters* perf=nullptr)
+        : a(&a), enabled(enabled), perf(perf) {
+        reset();
+    }
+
+    explicit stage_timer(bool enabled, const perf_counters::counters* perf=nullptr)
+        : a(nullptr), enabled(enabled), perf(perf) {
+        reset();
+    }
+
+    void operator()(const char* name, uint64_t n_cells=0){
+        auto now = std::chrono::steady_clock::now();
+#ifdef DMND_ALLOC_COUNTERS
+        const uint64_t n_alloc = alloc_counters::n_allocations - an0;
+        const uint64_t n_alloc_bytes = alloc_counters::n_bytes - ab0;
+        const uint64_t peak = alloc_counters::peak_live;
+#endif
+        if (perf){
+            perf_counters::print(name, perf->read() - p0, n_cells);
+        }
+        if (enabled){
+            double dt = std::chrono::duration<double>(now - t0).count();
+            if (a){
+                printf("[stage] %s: %.6f s, %lu allocations, %lu B\n", name, dt,
+                        (unsigned long)(a->counts().n_allocations - n0),
+                        (unsigned long)(a->counts().n_bytes - b0));
+            } else {
+                printf("[stage] %s: %.6f s\n", name, dt);
+            }
+#ifdef DMND_ALLOC_COUNTERS
+            printf("[alloc] %s: %lu allocations, %lu B, %lu B peak live\n", name,
+                    (unsigned long)n_alloc, (unsigned long)n_alloc_bytes,
+                    (unsigned long)peak);
+            alloc_counters::report_sites(name);
+#endif
+        }
+        reset();
+    }
+
+private:
+    const realisation_arena* a;
+    bool enabled;
+    const perf_counters::counters* perf;
+    std::chrono::steady_clock::time_point t0;
+    uint64_t n0 = 0, b0 = 0;
+    perf_counters::reading p0;
+#ifdef DMND_ALLOC_COUNTERS
+    uint64_t an0 = 0, ab0 = 0;
+#endif
+
+    void reset(){
+        if (a){
+            n0 = a->counts().n_allocations;
+            b0 = a->counts().n_bytes;
+        }
+#ifdef DMND_ALLOC_COUNTERS
+        an0 = alloc_counters::n_allocations;
+        ab0 = alloc_counters::n_bytes;
+        alloc_counters::reset_peak();
+#endif
+        t0 = std::chrono::steady_clock::now();
+        if (perf) p0 = perf->read();
+    }
+};
+
+} // end namespace arena
@@ -0,0 +1,93 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+/**
+ * Flat replacements for std::set<Cell*> keyed by a dense per-cell 'index'
+ * instead of by address, so that iteration order is deterministic.
+ *
+ * A cell_set holds a membership bitset over indices and its elements as
+ * (index, pointer) pairs, sorted on first iteration after an insertion.
+ * Membership tests and sorting never dereference the stored pointers, so a
+ * set may keep cells that have since been erased from the lattice, as long
+ * as it is only queried by index.
+ */
+
+// Numbers the cells of a SparseMap 0..n-1, in key order
+template<typename Map>
+inline void index_cells(Map& cells){
+    uint32_t i = 0;
+    for (auto& [_, c] : cells) c->index = i++;
+}
+
+
+template<typename T>
+class cell_set {
+public:
+    using value_type = T*;
+
+    // iterates over the pointers of a sorted element list
+    class const_iterator {
+    public:
+        using base = typename std::pmr::vector<std::pair<uint32_t, T*>>::const_iterator;
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T*;
+        using difference_type = std::ptrdiff_t;
+        using pointer = T* const*;
+        using reference = T*;
+
+        const_iterator() = default;
+        explicit const_iterator(base it) : it(it) {}
+        T* operator*() const { return it->second; }
+        const_iterator& operator++(){ ++it; return *this; }
+        const_iterator operator++(int){ auto res = *this; ++it; return res; }
+        bool operator==(const const_iterator& o) const { return it == o.it; }
+    private:
+        base it;
+    };
+
+    inline bool contains_index(uint32_t i) const {
+        return i < 64*bits.size() && ((bits[i >> 6] >> (i & 63)) & 1);
+    }
+
+    inline bool contains(const T* c) const { return contains_index(c->index); }
+
+    // Inserts c, unless a cell of the same index is present
+    inline bool insert(T* c){
+        const uint32_t i = c->index;
+        if (contains_index(i)) return false;
+        if (i >= 64*bits.size()) bits.resize((i >> 6) + 1, 0);
+        bits[i >> 6] |= uint64_t(1) << (i & 63);
+        sorted = sorted && (elems.empty() || elems.back().first < i);
+        elems.push_back({i, c});
+        return true;
+    }
+
+    inline size_t size() const { return elems.size(); }
+    inline bool empty() const { return elems.empty(); }
+
+    // Elements in index order
+    const_iterator begin() const {
+        sort();
+        return const_iterator(elems.begin());
+    }
+    const_iterator end() const { return const_iterator(elems.end()); }
+
+private:
+    std::pmr::vector<uint64_t> bits;
+    mutable std::pmr::vector<std::pair<uint32_t, T*>> elems;
+    mutable bool sorted = true;
+
+    inline void sort() const {
+        if (sorted) return;
+        std::sort(elems.begin(), elems.end(), [](const auto& a, const auto& b){
+            return a.first < b.first;
+        });
+        sorted = true;
+    }
+};
@@ -0,0 +1,233 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "implicit_diamond.hpp"
+
+/**
+ * Raw per-cell cluster membership, for analyses that need more than the
+ * statistics.
+ *
+ * A label file holds, for one cell dimension of the implicit lattice,
+ *  - a table of the clusters in the order of the statfile's size
+ *    histogram: size, wrapping flag (as in the stats) and winding,
+ *  - one uint32 label per cell, indexed by row-major (canonical) cell id:
+ *    0 for a dead cell, otherwise 1 + the cluster's row in the table.
+ * Sections are 8-byte aligned at the offsets given in the header, so the
+ * file can be mapped and used in place (mapped_labels below, or
+ * scripts/read_labels.py with numpy).
+ */
+
+namespace cluster_labels {
+
+inline constexpr uint32_t format_version = 1;
+
+inline constexpr char magic[8] = "DMNDLBL";
+
+struct file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t dim;
+    // the supercell as specified, columns are the supercell vectors
+    int64_t Z[3][3];
+    uint64_t n_cells;
+    uint64_t n_clusters;
+    // byte offsets of the cluster table and the labels
+    uint64_t clusters_at;
+    uint64_t labels_at;
+};
+
+struct cluster_record {
+    uint64_t size;
+    uint32_t wraps;
+    // for each supercell vector Z_k, the gcd of the number of times the
+    // cluster's closed loops wind along it; 0 if none winds along Z_k
+    int32_t winding[3];
+};
+
+
+/**
+ * Windings of the clusters labelled in lat.label (find_connected<dim>).
+ * Each cluster is searched again, carrying the unwrapped primitive-cell
+ * coordinates of its members; a face shared with a member already reached
+ * at a different unwrapped position closes a loop, whose translation is
+ * expressed in the supercell vectors Z.
+ */
+template<int dim>
+inline std::vector<std::array<int32_t, 3>> cluster_windings(
+        const implicit_diamond& lat, const imat33_t& Z, size_t n_clusters){
+    constexpr unsigned nsl = implicit_diamond::n_sl(dim);
+
+    std::vector<diamond::cell_offset> nbrs[nsl];
+    for (unsigned sl=0; sl<nsl; sl++) nbrs[sl] = face_neighbour_offsets(dim, sl);
+
+    // Z^-1 = adj(Z) / det(Z)
+    int64_t adj[3][3];
+    for (int i=0; i<3; i++){
+        for (int j=0; j<3; j++){
+            const int r0 = (j+1)%3, r1 = (j+2)%3, c0 = (i+1)%3, c1 = (i+2)%3;
+            adj[i][j] = Z(r0,c0)*Z(r1,c1) - Z(r0,c1)*Z(r1,c0);
+        }
+    }
+    int64_t det = 0;
+    for (int j=0; j<3; j++) det += Z(0,j)*adj[j][0];
+
+    const uint64_t N = lat.size(dim);
+    std::vector<std::array<int32_t, 3>> res(n_clusters, {0, 0, 0});
+    std::vector<std::array<int64_t, 3>> unwrapped(N);
+    std::vector<bool> seen(N, false);
+    std::vector<uint32_t> stack;
+
+    for (uint64_t root_cell=0; root_cell<N; root_cell++){
+        if (lat.label[root_cell] == 0 || seen[root_cell]) continue;
+        auto& w = res[lat.label[root_cell] - 1];
+
+        int64_t n[3];
+        lat.sc.coords_of(root_cell / nsl, n);
+        unwrapped[root_cell] = {n[0], n[1], n[2]};
+        seen[root_cell] = true;
+        stack.assign(1, root_cell);
+        while (!stack.empty()){
+            const auto curr = stack.back();
+            stack.pop_back();
+            for (const auto& o : nbrs[curr % nsl]){
+                auto next = lat.cell_at(curr, dim, o, dim);
+                if (lat.label[next] != lat.label[curr]) continue;
+
+                std::array<int64_t, 3> x;
+                for (int i=0; i<3; i++) x[i] = unwrapped[curr][i] + o.dn[i];
+                if (!seen[next]){
+                    seen[next] = true;
+                    unwrapped[next] = x;
+                    stack.push_back(next);
+                    continue;
+                }
+                if (x == unwrapped[next]) continue;
+
+                // x - unwrapped[next] is a supercell translation Z m
+                for (int k=0; k<3; k++){
+                    int64_t m = 0;
+                    for (int i=0; i<3; i++) m += adj[k][i] * (x[i] - unwrapped[next][i]);
+                    w[k] = std::gcd(w[k], int32_t(std::llabs(m / det)));
+                }
+            }
+        }
+    }
+    return res;
+}
+
+
+/**
+ * Writes the clusters of dimension 'dim' found by find_connected<dim>,
+ * which must be the last search run on 'lat' (the labels are shared).
+ */
+template<int dim>
+inline void write_file(const std::filesystem::path& path, const implicit_diamond& lat,
+        const imat33_t& Z, const std::vector<cluster_summary>& clusters){
+    file_header hd = {};
+    std::memcpy(hd.magic, magic, sizeof(magic));
+    hd.version = format_version;
+    hd.dim = dim;
+    for (int i=0; i<3; i++){
+        for (int j=0; j<3; j++) hd.Z[i][j] = Z(i,j);
+    }
+    hd.n_cells = lat.size(dim);
+    hd.n_clusters = clusters.size();
+    hd.clusters_at = sizeof(file_header);
+    hd.labels_at = hd.clusters_at + clusters.size()*sizeof(cluster_record);
+
+    auto windings = cluster_windings<dim>(lat, Z, clusters.size());
+    std::vector<cluster_record> table(clusters.size());
+    for (size_t i=0; i<clusters.size(); i++){
+        table[i].size = clusters[i].size;
+        table[i].wraps = clusters[i].wraps;
+        std::memcpy(table[i].winding, windings[i].data(), sizeof(table[i].winding));
+    }
+
+    std::vector<uint32_t> labels(lat.size(dim));
+    for (uint64_t id=0; id<labels.size(); id++){
+        labels[lat.canonical_id(dim, id)] = lat.label[id];
+    }
+
+    std::ofstream of(path, std::ios::binary);
+    if (!of) throw std::runtime_error("Cannot write label file "+path.string());
+    of.write(reinterpret_cast<const char*>(&hd), sizeof(hd));
+    of.write(reinterpret_cast<const char*>(table.data()), table.size()*sizeof(cluster_record));
+    of.write(reinterpret_cast<const char*>(labels.data()), labels.size()*sizeof(uint32_t));
+    of.close();
+    if (!of) throw std::runtime_error("Failed writing label file "+path.string());
+}
+
+
+/**
+ * A label file, mapped read-only.
+ */
+class mapped_labels {
+public:
+    explicit mapped_labels(const std::filesystem::path& path){
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Cannot open label file "+path.string());
+        struct stat st;
+        if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(file_header)){
+            ::close(fd);
+            throw std::runtime_error("Truncated label file "+path.string());
+        }
+        len = st.st_size;
+        void* p = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) throw std::runtime_error("Cannot map label file "+path.string());
+        base = static_cast<const char*>(p);
+
+        if (std::memcmp(header().magic, magic, sizeof(magic)) != 0
+                || header().version != format_version
+                || len < header().labels_at + header().n_cells*sizeof(uint32_t)){
+            munmap(const_cast<char*>(base), len);
+            throw std::runtime_error("Not a label file of this version: "+path.string());
+        }
+    }
+
+    ~mapped_labels(){
+        if (base) munmap(const_cast<char*>(base), len);
+    }
+
+    mapped_labels(const mapped_labels&) = delete;
+    mapped_labels& operator=(const mapped_labels&) = delete;
+    mapped_labels(mapped_labels&& other) noexcept : base(other.base), len(other.len) {
+        other.base = nullptr;
+    }
+
+    inline const file_header& header() const {
+        return *reinterpret_cast<const file_header*>(base);
+    }
+
+    inline std::span<const cluster_record> clusters() const {
+        return {reinterpret_cast<const cluster_record*>(base + header().clusters_at),
+            size_t(header().n_clusters)};
+    }
+
+    // indexed by canonical cell id
+    inline std::span<const uint32_t> labels() const {
+        return {reinterpret_cast<const uint32_t*>(base + header().labels_at),
+            size_t(header().n_cells)};
+    }
+
+private:
+    const char* base = nullptr;
+    size_t len = 0;
+};
+
+} // end namespace cluster_labels
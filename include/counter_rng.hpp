@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+
+/**
+ * Counter-based random numbers: the draw for cell 'counter' is a pure
+ * function of (seed, counter), so any subset of the lattice can be diluted
+ * in any order and still agree with every other traversal of it.
+ */
+
+// The SplitMix64 finaliser, a bijective avalanche mix of 64 bits
+inline constexpr uint64_t splitmix64(uint64_t z){
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+inline constexpr uint64_t counter_hash(uint64_t seed, uint64_t counter){
+    return splitmix64(splitmix64(seed) + (counter + 1) * 0x9e3779b97f4a7c15ull);
+}
+
+// Uniform double in [0, 1) from the top 53 bits
+inline constexpr double counter_uniform(uint64_t seed, uint64_t counter){
+    return (counter_hash(seed, counter) >> 11) * 0x1.0p-53;
+}
+
+inline constexpr bool counter_bernoulli(uint64_t seed, uint64_t counter, double p){
+    return counter_uniform(seed, counter) < p;
+}
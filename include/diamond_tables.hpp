@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+
+/**
+ * Incidence tables for the diamond cell complex, expressed as offsets
+ * between primitive FCC cells.
+ *
+ *   dim 0: points  (tetrahedra)           2 per primitive cell
+ *   dim 1: links   (pyrochlore spins)     4 per primitive cell
+ *   dim 2: plaqs   (hexagonal rings)      4 per primitive cell
+ *   dim 3: vols    (adamantane cages)     2 per primitive cell
+ *
+ * Positions use the integer units of PrimitiveSpecifiers::DiamondSpec, in
+ * which the conventional cubic cell has side 8 and the FCC primitive
+ * vectors are a1 = (0,4,4), a2 = (4,0,4), a3 = (4,4,0). The cell at integer
+ * coordinates n = (n1, n2, n3) sits at n1*a1 + n2*a2 + n3*a3.
+ *
+ * Entry {dn, sl, sign} of e.g. link_boundary[mu] reads: the link of sublattice
+ * mu in cell n has the point of sublattice 'sl' in cell n+dn on its boundary,
+ * with multiplicity 'sign'. The tables satisfy d(d(.)) = 0, and the vol
+ * boundaries reproduce the R0 -/+ (2 r_mu + r_nu) rule used for the Zr4
+ * dilution strategy.
+ */
+namespace diamond {
+
+struct cell_offset {
+    int8_t dn[3];
+    uint8_t sl;
+    int8_t sign;
+};
+
+// number of sublattices of each cell dimension
+inline constexpr unsigned n_sl[4] = {2, 4, 4, 2};
+
+// primitive vectors, stored as rows: prim_vectors[i] = a_{i+1}
+inline constexpr int64_t prim_vectors[3][3] = {
+    {0, 4, 4},
+    {4, 0, 4},
+    {4, 4, 0}
+};
+
+// position of each sublattice within the primitive cell at the origin
+inline constexpr int64_t sl_position[4][4][3] = {
+    {{0,0,0}, {2,2,2}},
+    {{1,1,1}, {1,-1,-1}, {-1,1,-1}, {-1,-1,1}},
+    {{5,5,5}, {5,3,3}, {3,5,3}, {3,3,5}},
+    {{4,4,4}, {6,6,6}}
+};
+
+inline constexpr cell_offset point_coboundary[2][4] = {
+    {{{0,0,0},0,-1}, {{0,0,0},1,-1}, {{0,0,0},2,-1}, {{0,0,0},3,-1}},
+    {{{0,0,0},0,+1}, {{1,0,0},1,+1}, {{0,1,0},2,+1}, {{0,0,1},3,+1}},
+};
+
+inline constexpr cell_offset link_boundary[4][2] = {
+    {{{0,0,0},0,-1}, {{0,0,0},1,+1}},
+    {{{0,0,0},0,-1}, {{-1,0,0},1,+1}},
+    {{{0,0,0},0,-1}, {{0,-1,0},1,+1}},
+    {{{0,0,0},0,-1}, {{0,0,-1},1,+1}},
+};
+
+inline constexpr cell_offset link_coboundary[4][6] = {
+    {{{0,0,-1},1,+1}, {{0,-1,0},1,-1}, {{0,0,-1},2,-1}, {{-1,0,0},2,+1}, {{0,-1,0},3,+1}, {{-1,0,0},3,-1}},
+    {{{-1,-1,0},0,+1}, {{-1,0,-1},0,-1}, {{-1,0,-1},2,+1}, {{-1,0,0},2,-1}, {{-1,0,0},3,+1}, {{-1,-1,0},3,-1}},
+    {{{0,-1,-1},0,+1}, {{-1,-1,0},0,-1}, {{0,-1,0},1,+1}, {{0,-1,-1},1,-1}, {{0,-1,0},3,-1}, {{-1,-1,0},3,+1}},
+    {{{0,-1,-1},0,-1}, {{-1,0,-1},0,+1}, {{0,0,-1},1,-1}, {{0,-1,-1},1,+1}, {{-1,0,-1},2,-1}, {{0,0,-1},2,+1}},
+};
+
+// boundary links of each hexagon, in cyclic order around the ring
+inline constexpr cell_offset plaq_boundary[4][6] = {
+    {{{1,1,0},1,+1}, {{0,1,1},3,-1}, {{0,1,1},2,+1}, {{1,0,1},1,-1}, {{1,0,1},3,+1}, {{1,1,0},2,-1}},
+    {{{0,1,0},2,+1}, {{0,0,1},3,-1}, {{0,0,1},0,+1}, {{0,1,1},2,-1}, {{0,1,1},3,+1}, {{0,1,0},0,-1}},
+    {{{1,0,1},3,-1}, {{1,0,1},1,+1}, {{0,0,1},0,-1}, {{0,0,1},3,+1}, {{1,0,0},1,-1}, {{1,0,0},0,+1}},
+    {{{1,0,0},1,+1}, {{0,1,0},2,-1}, {{0,1,0},0,+1}, {{1,1,0},1,-1}, {{1,1,0},2,+1}, {{1,0,0},0,-1}},
+};
+
+inline constexpr cell_offset plaq_coboundary[4][2] = {
+    {{{0,0,0},0,+1}, {{0,0,0},1,-1}},
+    {{{0,0,0},0,+1}, {{-1,0,0},1,-1}},
+    {{{0,0,0},0,+1}, {{0,-1,0},1,-1}},
+    {{{0,0,0},0,+1}, {{0,0,-1},1,-1}},
+};
+
+inline constexpr cell_offset vol_boundary[2][4] = {
+    {{{0,0,0},0,+1}, {{0,0,0},1,+1}, {{0,0,0},2,+1}, {{0,0,0},3,+1}},
+    {{{0,0,0},0,-1}, {{1,0,0},1,-1}, {{0,1,0},2,-1}, {{0,0,1},3,-1}},
+};
+
+} // end namespace diamond
@@ -0,0 +1,146 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <XoshiroCpp.hpp>
+#include <UnitCellSpecifier.hpp>
+
+#include "cell_set.hpp"
+#include "format_bits.hpp"
+
+/**
+ * Dilution strategies for the diamond lattice.
+ */
+
+inline void sort_and_remove_duplicates(std::vector<int>& v){
+    // Sort all of these so we don't muck up any indexing
+    std::sort(v.begin(), v.end());
+    // silently remove any duplicates
+    v.erase( unique( v.begin(), v.end() ), v.end() );
+}
+
+
+inline const ipos_t pyro_r[4] = {
+    {1,1,1},
+    {1,-1,-1},
+    {-1,1,-1},
+    {-1,-1,1}
+};
+
+
+inline const std::vector<std::array<int ,4>> mu_set = {
+    {0,1,2,3},
+    {0,1,3,2},
+    {0,2,1,3},
+    {0,2,3,1},
+    {0,3,1,2},
+    {0,3,2,1},
+    {1,0,2,3},
+    {1,0,3,2},
+    {1,2,0,3},
+    {1,2,3,0},
+    {1,3,0,2},
+    {1,3,2,0},
+    {2,0,1,3},
+    {2,0,3,1},
+    {2,1,0,3},
+    {2,1,3,0},
+    {2,3,0,1},
+    {2,3,1,0},
+    {3,0,1,2},
+    {3,0,2,1},
+    {3,1,0,2},
+    {3,1,2,0},
+    {3,2,0,1},
+    {3,2,1,0}
+};
+
+
+// Chooses (but does not delete) the spins to dilute. Shared by every tool
+// working on latticelab lattices, so that a seed means the same
+// realisation in all of them.
+template<typename Lattice, typename Spin>
+void determine_deleted_spins(
+        std::stringstream& name,
+        cell_set<Spin>& spins_to_yeet,
+        Lattice& lat, uint64_t seed,
+        const std::string& erase_strat,
+        double dilution_prob,
+        std::vector<int>& spin_ids_to_delete
+        ){
+
+    XoshiroCpp::Xoshiro256PlusPlus gen(seed);
+    char buf[1024];
+
+    if (erase_strat == "random"){
+        // Erase spins with probability p
+        std::bernoulli_distribution d1(dilution_prob);
+        for (const auto& [_, p] : lat.links) {
+            if (d1(gen)) spins_to_yeet.insert(p);
+        }
+        snprintf(buf, 1024, "p=%.04f;seed=%llx;", dilution_prob, (unsigned long long)seed);
+        name << buf;
+    } else if (erase_strat == "Zr4") {
+        // Erase spins coordinated with a dual-tetrahedron (motivated by O2- in center of the Zr4+)
+        std::bernoulli_distribution d_O2(dilution_prob/2);
+//        std::uniform_int_distribution<size_t> d_first_site(0,11);
+        std::vector<ipos_t> stuffed_dual_tetras;
+        // decide where the O2 goes
+        for (const auto& [_, v] : lat.vols) {
+            if (d_O2(gen)) stuffed_dual_tetras.push_back(v->position);
+        }
+
+        auto _mu_set = mu_set;
+
+        // ... and kill two of the links.
+        for (const auto& R0 : stuffed_dual_tetras){
+            auto vol_sl = lat.primitive_spec.sl_of_vol(R0);
+
+            // choose this by jumping randomly to one of 4 nn
+            // direct-lattice tetrahedra, then choosing a random sl
+
+    
+            // observation: 1. spins lying on all sl=0 cages can be written as
+            // void_center +/- ( 2*pyro_r[mu] + pyro_r[nu]) (- for sl=1 case)
+            // obs. 2: second-neighbours (supporting singlets) are exactly the cases where 
+            // mu1, nu1, mu2, nu2 are all distinct.
+            
+            std::shuffle(_mu_set.begin(), _mu_set.end(), gen);
+
+            Spin* s1;
+            Spin* s2;
+            for (int i=0; i<24; i++){
+                auto& mu = _mu_set[i];
+                const auto& R1 = R0 - (1 - 2*vol_sl) * ( 2* pyro_r[mu[0]] + pyro_r[mu[1]]);
+                const auto& R2 = R0 - (1 - 2*vol_sl) * ( 2* pyro_r[mu[2]] + pyro_r[mu[3]]);          
+                s1 = &lat.get_link_at(R1);
+                s2 = &lat.get_link_at(R2);
+
+                if (!(spins_to_yeet.contains(s1) || spins_to_yeet.contains(s2))){
+                    spins_to_yeet.insert(s1);
+                    spins_to_yeet.insert(s2);
+                    break;
+                }
+            } 
+        }
+    
+        snprintf(buf, 1024, "pZr=%.04f;seed=%llx;", dilution_prob/2, (unsigned long long)seed);
+        name << buf;
+    } else if (erase_strat == "specific"){
+        // Erase the specified spins
+        if (spin_ids_to_delete.size() > 0){
+            std::cout << "Erasing SPECIFIC spins\n";
+            sort_and_remove_duplicates(spin_ids_to_delete);
+            for (auto& x : spin_ids_to_delete){
+                spins_to_yeet.insert(lat.links.at(x));
+            }
+            name << comma_separate("d1", spin_ids_to_delete);
+        }
+    } else { throw std::logic_error("bad dilution strategy"); }
+}
@@ -0,0 +1,114 @@
+#ifndef DMND_H
+#define DMND_H
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * C API of libdmnd: the implicit-engine pipeline of dmnd_dilute (dilution,
+ * defect excision, cluster statistics) for drivers that run many
+ * realisations in one process, e.g. from Python through ctypes.
+ *
+ * A dmnd_lattice is an opaque handle on one supercell; every call to
+ * dmnd_realise restores it to the undiluted lattice first, so a handle is
+ * built once and reused for any number of realisations. Handles are not
+ * shared between threads, but distinct handles may be used concurrently.
+ *
+ * Functions returning int give 0 on success and -1 on failure, with the
+ * reason in dmnd_last_error(). Nothing is allocated for the caller: results
+ * are written to caller-provided structs and buffers.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bumped whenever a struct below changes layout
+#define DMND_API_VERSION 1
+
+// Longest path length whose excision count fits in dmnd_result
+#define DMND_MAX_PATH_LEN 32
+
+enum dmnd_strategy {
+    DMND_RANDOM = 0,
+    DMND_ZR4 = 1,
+    DMND_SPECIFIC = 2
+};
+
+typedef struct dmnd_lattice dmnd_lattice;
+
+typedef struct {
+    uint64_t seed;
+    double dilution_prob;
+    int32_t strategy;       // a dmnd_strategy
+    int32_t cascade;        // nonzero: as dmnd_dilute --cascade
+    // link ids to delete with DMND_SPECIFIC, as dmnd_dilute -d
+    const int32_t* specific_ids;
+    size_t n_specific_ids;
+    // path lengths to excise, as dmnd_dilute -n
+    const int32_t* neighbours;
+    size_t n_neighbours;
+    // nonzero: keep every cell's cluster label for dmnd_cluster_labels
+    int32_t keep_labels;
+} dmnd_params;
+
+// The percolation observables of one cell dimension, as in .stats.json
+typedef struct {
+    uint64_t n_alive;
+    uint64_t n_clusters;
+    uint64_t largest;
+    uint64_t second_largest;
+    double P_inf;
+    double mean_size;
+    double largest_Rg;      // NaN if the largest cluster wraps
+    int32_t wraps;
+    int32_t reserved;
+} dmnd_cluster_stats;
+
+typedef struct {
+    // links (0), plaqs (1) and vols (2)
+    dmnd_cluster_stats clusters[3];
+    // paths excised from the original defects, by length (n_dimers in
+    // .stats.json), and the number of cascade generations run
+    uint64_t n_dimers[DMND_MAX_PATH_LEN + 1];
+    uint64_t n_generations;
+} dmnd_result;
+
+int dmnd_api_version(void);
+
+// Message of the last failure on this thread
+const char* dmnd_last_error(void);
+
+/**
+ * A supercell spanned by the columns of Z (row-major, Z[3*i + j] = Z(i,j)),
+ * as dmnd_dilute's Z1 Z2 Z3, laid out as with --block. NULL on failure.
+ */
+dmnd_lattice* dmnd_lattice_new(const int64_t Z[9], unsigned block);
+
+void dmnd_lattice_free(dmnd_lattice* lat);
+
+// Number of cells of dimension dim (0-3) in the undiluted supercell
+uint64_t dmnd_lattice_size(const dmnd_lattice* lat, int dim);
+
+// Runs one realisation, overwriting the previous one
+int dmnd_realise(dmnd_lattice* lat, const dmnd_params* params, dmnd_result* res);
+
+/**
+ * Sizes of the clusters of dimension dim (1-3) of the last realisation, in
+ * statfile order. Writes min(n, cap) of them to buf and returns n, the
+ * number of clusters, or -1 on failure.
+ */
+int64_t dmnd_cluster_sizes(const dmnd_lattice* lat, int dim, uint64_t* buf, size_t cap);
+
+/**
+ * Cluster labels of the cells of dimension dim (1-3) of the last
+ * realisation, which must have been run with keep_labels, indexed by
+ * row-major cell id: 0 for a dead cell, otherwise 1 + the cluster's index
+ * in dmnd_cluster_sizes. buf must hold dmnd_lattice_size(lat, dim) labels.
+ */
+int dmnd_cluster_labels(const dmnd_lattice* lat, int dim, uint32_t* buf, size_t cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,598 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "geom_traverser.hpp"
+#include "implicit_diamond.hpp"
+#include "implicit_pipeline.hpp"
+
+/**
+ * Exact disorder averages on small supercells. Every set of at most
+ * max_deleted deleted links is visited once, depth first: a set is its
+ * parent (the set without its largest link) plus one link, and the state of
+ * each parent along the current branch is kept, so a step only ever erases
+ * one link. Defects (the endpoints of the deleted links) are carried over
+ * from the parent, and only the clusters that contained a cell the step
+ * killed are relabelled. Excision, which is not monotonic in the deleted
+ * set, is applied to a copy of each set's diluted state.
+ *
+ * Without defect paths, sets related by a supercell translation give the
+ * same observables, so only one representative of each orbit is evaluated,
+ * weighted by the size of its orbit. Excision takes defects in id order,
+ * which a translation does not preserve, so with 'lens' every set is
+ * evaluated. Observables are summed separately for each number of
+ * deleted links j; the average at any p then follows from the weights
+ * p^j (1-p)^(N-j).
+ */
+
+namespace exact_enumeration {
+
+// Face neighbours of each sublattice, and their displacements, as
+// find_connected builds them
+struct face_neighbours {
+    std::vector<diamond::cell_offset> nbrs[4][4];
+    std::vector<ipos_t> disp[4][4];
+
+    face_neighbours(){
+        for (int dim=1; dim<4; dim++){
+            for (unsigned sl=0; sl<implicit_diamond::n_sl(dim); sl++){
+                nbrs[dim][sl] = face_neighbour_offsets(dim, sl);
+                for (const auto& o : nbrs[dim][sl]){
+                    disp[dim][sl].push_back(implicit_diamond::displacement(dim, sl, o));
+                }
+            }
+        }
+    }
+};
+
+inline constexpr uint32_t no_witness = UINT32_MAX;
+
+
+// A deleted set, diluted but not excised, with its clusters
+struct config_state {
+    implicit_diamond lat;
+    std::vector<uint32_t> label[4];
+    // by label - 1; a cluster that has been split up has size 0. Moments
+    // are not kept up to date once a cluster loses cells.
+    std::vector<cluster_summary> parts[4];
+    // by label - 1: the lowest id of each cluster, and for a wrapping
+    // cluster a member further than sqrt(Lmin2)/2 from it
+    std::vector<uint32_t> root[4];
+    std::vector<uint32_t> witness[4];
+    // endpoints of the deleted links, in id order
+    std::vector<uint32_t> defects;
+
+    explicit config_state(const imat33_t& Z) : lat(Z) {
+        label_all<1>();
+        label_all<2>();
+        label_all<3>();
+    }
+
+    template<int dim>
+    void label_all(){
+        parts[dim] = find_connected<dim>(lat);
+        label[dim] = lat.label;
+        root[dim].assign(parts[dim].size(), no_witness);
+        witness[dim].assign(parts[dim].size(), no_witness);
+        for (uint32_t id=0; id<label[dim].size(); id++){
+            const auto l = label[dim][id];
+            if (l == 0) continue;
+            if (root[dim][l-1] == no_witness){
+                root[dim][l-1] = id;
+            } else if (parts[dim][l-1].wraps && witness[dim][l-1] == no_witness
+                    && lat.d2(dim, id, root[dim][l-1]) > lat.Lmin2/4){
+                witness[dim][l-1] = id;
+            }
+        }
+    }
+};
+
+
+// Scratch of relabel, shared by every state
+struct workspace {
+    face_neighbours fn;
+    // search that visited each cell, as mark - base
+    std::vector<uint32_t> mark[4];
+    uint32_t base = 1;
+
+    // breadth first, so searches from around a cut meet close to it
+    struct search {
+        std::vector<uint32_t> cells;
+        size_t head;
+        bool done() const { return head == cells.size(); }
+    };
+    std::vector<search> searches;
+
+    explicit workspace(const implicit_diamond& lat){
+        for (int dim=1; dim<4; dim++) mark[dim].assign(lat.size(dim), 0);
+    }
+
+    // Marks for 'n' new searches
+    uint32_t new_marks(uint32_t n){
+        if (base > UINT32_MAX - n){
+            for (int dim=1; dim<4; dim++) std::fill(mark[dim].begin(), mark[dim].end(), 0);
+            base = 1;
+        }
+        const auto res = base;
+        base += n;
+        return res;
+    }
+};
+
+
+/**
+ * Labels the cells with label 'from' connected to 'start' as a new cluster,
+ * searched and tested for wrapping as find_connected does
+ */
+template<int dim>
+inline void split_off(config_state& s, uint32_t start, uint32_t from, const face_neighbours& fn){
+    constexpr unsigned nsl = implicit_diamond::n_sl(dim);
+    auto& lat = s.lat;
+    auto& label = s.label[dim];
+
+    cluster_summary cell_union;
+    s.parts[dim].push_back({});
+    const uint32_t l = s.parts[dim].size();
+    std::vector<uint32_t> members;
+    std::vector<std::pair<uint32_t, ipos_t>> stack;
+
+    label[start] = l;
+    stack.push_back({start, lat.position(dim, start)});
+    while (!stack.empty()){
+        auto [curr, x] = stack.back();
+        stack.pop_back();
+        cell_union.size++;
+        cell_union.moments.add(x);
+        members.push_back(curr);
+
+        const unsigned sl = curr % nsl;
+        for (size_t j=0; j<fn.nbrs[dim][sl].size(); j++){
+            auto next = lat.cell_at(curr, dim, fn.nbrs[dim][sl][j], dim);
+            if (label[next] == from && lat.is_alive(dim, next)){
+                label[next] = l;
+                stack.push_back({next, x + fn.disp[dim][sl][j]});
+            }
+        }
+    }
+
+    const auto root = *std::min_element(members.begin(), members.end());
+    auto witness = no_witness;
+    for (auto m : members){
+        if (lat.d2(dim, m, root) > lat.Lmin2/4){
+            witness = m;
+            break;
+        }
+    }
+    cell_union.wraps = witness != no_witness;
+    cell_union.spans = spans_supercell(cell_union.moments, lat.Lmin2);
+    s.parts[dim][l-1] = cell_union;
+    s.root[dim].push_back(root);
+    s.witness[dim].push_back(witness);
+}
+
+
+/**
+ * Updates cluster l, which lost cells but stays connected, to its new
+ * size, again testing for wrapping from its lowest id. The members are only scanned if
+ * the old root or witness is gone.
+ */
+template<int dim>
+inline void shrink(config_state& s, uint32_t l, size_t size){
+    auto& lat = s.lat;
+    const auto& label = s.label[dim];
+    auto& root = s.root[dim][l-1];
+    auto& witness = s.witness[dim][l-1];
+    auto& part = s.parts[dim][l-1];
+    const bool wrapped = part.wraps;
+    part = {};
+    part.size = size;
+
+    auto member = [&](uint32_t id){ return id != no_witness && label[id] == l; };
+    const bool same_root = member(root);
+    if (!same_root){
+        // nothing below the old root was a member
+        uint32_t r = root;
+        while (!member(r)) r++;
+        root = r;
+    }
+    if (same_root && (!wrapped || member(witness))){
+        part.wraps = wrapped;
+        return;
+    }
+    witness = no_witness;
+    for (uint32_t id=0; id<label.size(); id++){
+        if (member(id) && lat.d2(dim, id, root) > lat.Lmin2/4){
+            witness = id;
+            break;
+        }
+    }
+    part.wraps = witness != no_witness;
+}
+
+
+/**
+ * Relabels the clusters of s that lost a cell since its cells of dimension
+ * dim were alive as in 'before'. The live neighbours of the lost cells are
+ * searched from in lockstep, merging searches that meet, until at most one
+ * group of them is still growing: the exhausted groups are the pieces that
+ * split off, and the last group keeps the cluster's label without being
+ * searched to the end. Removing a few cells from the spanning cluster thus
+ * costs about the size of what breaks off, not of the cluster.
+ */
+template<int dim>
+inline void relabel(config_state& s, const std::vector<uint64_t>& before, workspace& ws){
+    constexpr unsigned nsl = implicit_diamond::n_sl(dim);
+    auto& lat = s.lat;
+    auto& label = s.label[dim];
+    auto& mark = ws.mark[dim];
+    const auto& fn = ws.fn;
+
+    std::vector<uint32_t> killed;
+    for (size_t w=0; w<before.size(); w++){
+        uint64_t gone = before[w] & ~lat.alive[dim][w];
+        while (gone){
+            killed.push_back(64*w + std::countr_zero(gone));
+            gone &= gone - 1;
+        }
+    }
+
+    // the lost cells of each cluster
+    std::vector<std::pair<uint32_t, uint32_t>> by_cluster;
+    for (auto c : killed){
+        by_cluster.push_back({label[c], c});
+        label[c] = 0;
+    }
+    std::sort(by_cluster.begin(), by_cluster.end());
+
+    for (size_t a=0; a<by_cluster.size();){
+        const uint32_t l = by_cluster[a].first;
+        size_t b = a;
+        while (b < by_cluster.size() && by_cluster[b].first == l) b++;
+        size_t size = s.parts[dim][l-1].size - (b - a);
+
+        std::vector<uint32_t> seeds;
+        for (size_t i=a; i<b; i++){
+            const auto c = by_cluster[i].second;
+            for (const auto& o : fn.nbrs[dim][c % nsl]){
+                const auto n = lat.cell_at(c, dim, o, dim);
+                if (label[n] == l && lat.is_alive(dim, n)) seeds.push_back(n);
+            }
+        }
+        std::sort(seeds.begin(), seeds.end());
+        seeds.erase(std::unique(seeds.begin(), seeds.end()), seeds.end());
+        a = b;
+
+        if (seeds.empty()){
+            s.parts[dim][l-1] = {};
+            continue;
+        }
+
+        const uint32_t m = seeds.size();
+        const uint32_t base = ws.new_marks(m);
+        ws.searches.resize(std::max<size_t>(ws.searches.size(), m));
+        std::vector<uint32_t> group(m);
+        auto find = [&](uint32_t i){
+            while (group[i] != i) i = group[i] = group[group[i]];
+            return i;
+        };
+        for (uint32_t i=0; i<m; i++){
+            auto& sr = ws.searches[i];
+            sr.cells.assign(1, seeds[i]);
+            sr.head = 0;
+            group[i] = i;
+            mark[seeds[i]] = base + i;
+        }
+
+        uint32_t n_groups = m;
+        std::vector<uint32_t> open(m);
+        while (n_groups > 1){
+            // groups with a search that can still grow
+            std::fill(open.begin(), open.end(), 0);
+            uint32_t n_open = 0;
+            for (uint32_t i=0; i<m; i++){
+                if (!ws.searches[i].done() && !open[find(i)]++) n_open++;
+            }
+            if (n_open <= 1) break;
+
+            for (uint32_t i=0; i<m; i++){
+                auto& sr = ws.searches[i];
+                if (sr.done()) continue;
+                const auto curr = sr.cells[sr.head++];
+                for (const auto& o : fn.nbrs[dim][curr % nsl]){
+                    const auto n = lat.cell_at(curr, dim, o, dim);
+                    if (label[n] != l || !lat.is_alive(dim, n)) continue;
+                    if (mark[n] < base || mark[n] >= base + m){
+                        mark[n] = base + i;
+                        sr.cells.push_back(n);
+                    } else {
+                        const auto gi = find(i), gj = find(mark[n] - base);
+                        if (gi != gj){
+                            group[gj] = gi;
+                            n_groups--;
+                        }
+                    }
+                }
+            }
+        }
+
+        // every exhausted group but the last is a piece that broke off
+        uint32_t keep = UINT32_MAX;
+        for (uint32_t i=0; i<m && n_groups > 1; i++){
+            if (!ws.searches[i].done()) keep = find(i);
+        }
+        std::vector<bool> done(m, false);
+        for (uint32_t i=0; i<m && n_groups > 1; i++){
+            const auto g = find(i);
+            if (g == keep || done[g]) continue;
+            if (keep == UINT32_MAX){
+                // all exhausted: the first group stays
+                keep = g;
+                continue;
+            }
+            done[g] = true;
+            const auto before_size = s.parts[dim].size();
+            split_off<dim>(s, seeds[i], l, fn);
+            size -= s.parts[dim][before_size].size;
+        }
+        shrink<dim>(s, l, size);
+    }
+}
+
+
+inline void relabel_all(config_state& s, const implicit_diamond& before, workspace& ws){
+    relabel<1>(s, before.alive[1], ws);
+    relabel<2>(s, before.alive[2], ws);
+    relabel<3>(s, before.alive[3], ws);
+}
+
+
+// Overwrites child with parent less 'link'
+inline void extend(config_state& child, const config_state& parent, uint32_t link,
+        workspace& ws){
+    child = parent;
+    for (const auto& b : diamond::link_boundary[link % 4]){
+        const auto pt = child.lat.cell_at(link, 1, b, 0);
+        auto it = std::lower_bound(child.defects.begin(), child.defects.end(), pt);
+        if (it == child.defects.end() || *it != pt) child.defects.insert(it, pt);
+    }
+    child.lat.erase_link(link);
+    relabel_all(child, parent.lat, ws);
+}
+
+
+template<int dim>
+inline cluster_stats live_stats(const config_state& s){
+    std::vector<cluster_summary> live;
+    for (const auto& p : s.parts[dim]){
+        if (p.size != 0) live.push_back(p);
+    }
+    return summarise_clusters(live, s.lat.size(dim));
+}
+
+inline std::vector<std::string> observable_names(const std::vector<int>& lens){
+    std::vector<std::string> res;
+    for (std::string d : {"link", "plaq", "vol"}){
+        for (const auto& o : {d+"s", d+"s_wrap", "n_"+d+"_parts", d+"_largest",
+                d+"_second_largest", d+"_P_inf", d+"_mean_size"}){
+            res.push_back(o);
+        }
+    }
+    for (auto len : lens) res.push_back("n_dimers_" + std::to_string(len));
+    res.push_back("n_generations");
+    return res;
+}
+
+inline void append_stats(std::vector<double>& out, const config_state& s, int dim,
+        const cluster_stats& c){
+    out.push_back(s.lat.count_alive(dim));
+    out.push_back(c.wraps);
+    out.push_back(c.n_clusters);
+    out.push_back(c.largest);
+    out.push_back(c.second_largest);
+    out.push_back(c.P_inf);
+    out.push_back(c.mean_size);
+}
+
+// The cluster statistics and path counts of one configuration, in the
+// order of observable_names
+inline std::vector<double> observables_of(const config_state& s, const std::vector<int>& lens,
+        const std::vector<std::map<size_t, size_t>>& n_dimers){
+    std::vector<double> res;
+    append_stats(res, s, 1, live_stats<1>(s));
+    append_stats(res, s, 2, live_stats<2>(s));
+    append_stats(res, s, 3, live_stats<3>(s));
+    for (auto len : lens){
+        auto it = n_dimers.front().find(len);
+        res.push_back(it == n_dimers.front().end() ? 0 : it->second);
+    }
+    res.push_back(n_dimers.size());
+    return res;
+}
+
+
+// Translates every link of 'links' by -n (primitive cells), sorted
+inline std::vector<uint32_t> translated(const implicit_diamond& lat,
+        const std::vector<uint32_t>& links, const int64_t n[3]){
+    constexpr unsigned nsl = implicit_diamond::n_sl(1);
+    std::vector<uint32_t> res;
+    for (auto l : links){
+        int64_t m[3];
+        lat.sc.coords_of(l / nsl, m);
+        for (int i=0; i<3; i++) m[i] -= n[i];
+        res.push_back(lat.sc.index_of(m)*nsl + l % nsl);
+    }
+    std::sort(res.begin(), res.end());
+    return res;
+}
+
+/**
+ * Size of the translation orbit of 'links' (sorted, with a link in cell 0)
+ * if it is the orbit's representative, otherwise 0. The representative is
+ * the lexicographically least of the translates with a link in cell 0,
+ * which are exactly the translates taking one of its cells to cell 0.
+ */
+inline uint64_t orbit_size(const implicit_diamond& lat, const std::vector<uint32_t>& links){
+    constexpr unsigned nsl = implicit_diamond::n_sl(1);
+    uint64_t n_stab = 0;
+    uint64_t prev_cell = UINT64_MAX;
+    for (auto l : links){
+        if (l / nsl == prev_cell) continue;
+        prev_cell = l / nsl;
+        int64_t n[3];
+        lat.sc.coords_of(prev_cell, n);
+        auto t = translated(lat, links, n);
+        if (t < links) return 0;
+        n_stab += (t == links);
+    }
+    return lat.sc.n_cells / n_stab;
+}
+
+
+// Observables summed over all sets of j deleted links, j = 0..max_deleted
+struct sums {
+    uint64_t n_configs = 0;
+    uint64_t n_representatives = 0;
+    std::vector<long double> values;
+
+    void add(const std::vector<double>& obs, uint64_t weight){
+        if (values.empty()) values.assign(obs.size(), 0);
+        for (size_t i=0; i<obs.size(); i++) values[i] += (long double)(weight) * obs[i];
+        n_configs += weight;
+        n_representatives++;
+    }
+};
+
+
+/**
+ * The enumeration of one supercell. The lattice is row-major (block 0), so
+ * ids are canonical ids. With 'verify', every set evaluated, and with
+ * by_orbit one other set of its orbit, is also run through the full
+ * pipeline from scratch and compared.
+ */
+struct enumeration {
+    std::vector<int> lens;
+    bool cascade;
+    unsigned max_deleted;
+    bool verify;
+    bool by_orbit; // one set per translation orbit, see above
+
+    // states[d]: the current set's first d links
+    std::vector<config_state> states;
+    config_state work;
+    workspace ws;
+    std::vector<uint32_t> chosen;
+    std::vector<sums> by_deleted;
+    uint64_t n_mismatches = 0;
+
+    enumeration(const imat33_t& Z, const std::vector<int>& lens, bool cascade,
+            unsigned max_deleted, bool verify) :
+        lens(lens), cascade(cascade), max_deleted(max_deleted), verify(verify),
+        by_orbit(lens.empty()), states(max_deleted + 1, config_state(Z)), work(states[0]), ws(work.lat),
+        by_deleted(max_deleted + 1) {
+        if (max_deleted >= states[0].lat.size(1)){
+            throw std::invalid_argument("Cannot delete every link");
+        }
+    }
+
+    void run(){
+        by_deleted[0].add(evaluate(0), 1);
+        if (max_deleted > 0) visit(0, 0);
+
+        // every set is counted once over its orbit
+        for (unsigned j=0; j<=max_deleted; j++){
+            if (by_deleted[j].n_configs != binomial(states[0].lat.size(1), j)){
+                throw std::logic_error("Orbits do not cover the deleted sets of size "
+                        + std::to_string(j));
+            }
+        }
+    }
+
+    // C(n, k); c*(n - k + i) is divisible by i, so dividing out their
+    // common factor first keeps every step exact in 64 bits
+    static uint64_t binomial(uint64_t n, unsigned k){
+        uint64_t c = 1;
+        for (unsigned i=1; i<=k; i++){
+            const uint64_t g = std::gcd(c, uint64_t(i));
+            if (__builtin_mul_overflow(c / g, (n - k + i) / (i / g), &c)){
+                throw std::overflow_error("Binomial coefficient overflows 64 bits");
+            }
+        }
+        return c;
+    }
+
+private:
+    void visit(unsigned depth, uint32_t first){
+        const auto& lat = states[0].lat;
+        // the smallest link of a representative lies in cell 0
+        const uint32_t last = depth == 0 && by_orbit ? implicit_diamond::n_sl(1) : lat.size(1);
+        for (uint32_t l=first; l<last; l++){
+            chosen.push_back(l);
+            const bool leaf = depth + 1 == max_deleted;
+            const auto orbit = by_orbit ? orbit_size(lat, chosen) : 1;
+            if (orbit != 0 || !leaf){
+                extend(states[depth + 1], states[depth], l, ws);
+            }
+            if (orbit != 0){
+                by_deleted[depth + 1].add(evaluate(depth + 1), orbit);
+            }
+            if (!leaf) visit(depth + 1, l + 1);
+            chosen.pop_back();
+        }
+    }
+
+    std::vector<double> evaluate(unsigned depth){
+        const auto& s = states[depth];
+        std::vector<double> obs;
+        if (lens.empty()){
+            obs = observables_of(s, lens, {{}});
+        } else {
+            work = s;
+            std::vector<std::map<size_t, size_t>> n_dimers;
+            auto worklist = s.defects;
+            do {
+                n_dimers.emplace_back();
+                worklist = excise_defect_paths(work.lat, worklist, lens, n_dimers.back(), false);
+            } while (cascade && !worklist.empty());
+            relabel_all(work, s.lat, ws);
+            obs = observables_of(work, lens, n_dimers);
+        }
+        if (verify){
+            if (obs != from_scratch(chosen)) n_mismatches++;
+            if (by_orbit && obs != from_scratch(other_translate())) n_mismatches++;
+        }
+        return obs;
+    }
+
+    // A translate of 'chosen' other than itself, if there is one
+    std::vector<uint32_t> other_translate() const {
+        const auto& lat = states[0].lat;
+        for (uint64_t c=1; c<lat.sc.n_cells; c++){
+            int64_t n[3];
+            lat.sc.coords_of(c, n);
+            auto t = translated(lat, chosen, n);
+            if (t != chosen) return t;
+        }
+        return chosen;
+    }
+
+    // The observables of 'links' by the pipeline of dmnd_dilute's implicit engine
+    std::vector<double> from_scratch(const std::vector<uint32_t>& links) const {
+        config_state ref(states[0]);
+        ref.lat.reset();
+        auto n_dimers = dilute_and_excise(ref.lat, links, lens, cascade, false);
+        ref.label_all<1>();
+        ref.label_all<2>();
+        ref.label_all<3>();
+        return observables_of(ref, lens, n_dimers);
+    }
+};
+
+} // end namespace exact_enumeration
@@ -0,0 +1,13 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// FNV-1a over raw bytes
+inline uint64_t fnv1a(const void* data, size_t n, uint64_t h=0xcbf29ce484222325ull){
+    auto p = static_cast<const unsigned char*>(data);
+    for (size_t i=0; i<n; i++){
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
@@ -1,11 +1,18 @@
 #pragma once
 #include <cell_geometry.hpp>
+#include <deque>
+#include <memory_resource>
 #include <stack>
-#include <set>
+#include <type_traits>
+#include <vector>
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <UnitCellSpecifier.hpp>
 #include <chain.hpp>
 
+#include "work_counters.hpp"
+
 template<typename T>
 concept Visitable = requires(T t) {
     // { t.visited } -> std::same_as<bool&>;
@@ -13,12 +20,161 @@ concept Visitable = requires(T t) {
     { t.position } -> std::convertible_to<const ipos_t>;
 };
 
+// First and second moments of a cluster's unwrapped member positions, and
+// their bounding box, accumulated as the cluster is built
+struct cluster_moments {
+    double sum[3] = {0, 0, 0};
+    double sum2 = 0;
+    int64_t lo[3] = {INT64_MAX, INT64_MAX, INT64_MAX};
+    int64_t hi[3] = {INT64_MIN, INT64_MIN, INT64_MIN};
+
+    inline void add(const ipos_t& x){
+        for (int k=0; k<3; k++){
+            sum[k] += x[k];
+            sum2 += double(x[k])*x[k];
+            lo[k] = std::min<int64_t>(lo[k], x[k]);
+            hi[k] = std::max<int64_t>(hi[k], x[k]);
+        }
+    }
+
+    // Absorbs the n-member moments m, whose frame is displaced by o from this one
+    inline void merge(const cluster_moments& m, size_t n, const ipos_t& o){
+        if (n == 0) return;
+        sum2 += m.sum2;
+        for (int k=0; k<3; k++){
+            sum2 += 2*o[k]*m.sum[k] + double(n)*o[k]*o[k];
+            sum[k] += m.sum[k] + double(n)*o[k];
+            lo[k] = std::min<int64_t>(lo[k], m.lo[k] + o[k]);
+            hi[k] = std::max<int64_t>(hi[k], m.hi[k] + o[k]);
+        }
+    }
+
+    // Squared diagonal of the bounding box. The unwrapped positions of a
+    // cluster that does not wind around the supercell do not depend on the
+    // search, and one that winds spans about a supercell vector.
+    inline double extent2() const {
+        double e2 = 0;
+        for (int k=0; k<3; k++){
+            if (hi[k] >= lo[k]) e2 += double(hi[k] - lo[k])*(hi[k] - lo[k]);
+        }
+        return e2;
+    }
+
+    // squared radius of gyration of an n-member cluster
+    inline double Rg2(size_t n) const {
+        if (n == 0) return 0;
+        double r2 = sum2/n;
+        for (int k=0; k<3; k++) r2 -= (sum[k]/n)*(sum[k]/n);
+        return std::max(r2, 0.0);
+    }
+};
+
+// Members are listed in the order they were found. 'spans' is set if the
+// unwrapped members reach across the supercell (see spans_supercell), in
+// which case their Rg is not defined.
 template<Visitable T>
 struct conn_components {
-    std::set<T*> elems;
+    std::pmr::vector<T*> elems;
+    bool wraps = false;
+    bool spans = false;
+    cluster_moments moments;
+};
+
+// What the statistics need of a cluster, for engines that never hold
+// its member list
+struct cluster_summary {
+    size_t size = 0;
+    bool wraps = false;
+    bool spans = false;
+    cluster_moments moments;
+};
+
+// Squared length of the longest step between face neighbours, in any
+// dimension (a primitive vector, in units of 1/8 of the cubic cell)
+constexpr double max_face_step2 = 32;
+
+// Whether the unwrapped members of a cluster with moments m reach to within
+// one step of the shortest supercell vector. A cluster winding around the
+// supercell has two neighbours unwrapped a supercell vector apart, so it
+// does whatever the search; this decides whether the Rg of a cluster means
+// the same in every engine.
+inline bool spans_supercell(const cluster_moments& m, double Lmin2){
+    const double reach = std::sqrt(Lmin2) - std::sqrt(max_face_step2);
+    return reach <= 0 || m.extent2() >= reach*reach;
+}
+
+template<Visitable T>
+inline size_t cluster_size(const conn_components<T>& c){ return c.elems.size(); }
+
+// The dimension of a cell type derived from CellGeometry::Cell<dim>
+template <typename T>
+constexpr int cell_dim(){
+    if constexpr (std::is_base_of_v<CellGeometry::Cell<3>, T>) return 3;
+    else if constexpr (std::is_base_of_v<CellGeometry::Cell<2>, T>) return 2;
+    else if constexpr (std::is_base_of_v<CellGeometry::Cell<1>, T>) return 1;
+    else return 0;
+}
+
+inline size_t cluster_size(const cluster_summary& c){ return c.size; }
+
+// The cells in all of 'parts', i.e. those a labelling visited
+template <typename C>
+inline size_t total_size(const std::vector<C>& parts){
+    size_t n = 0;
+    for (const auto& p : parts) n += cluster_size(p);
+    return n;
+}
+
+
+/**
+ * Cluster observables, from the sizes and moments gathered during labelling:
+ *  - largest, second_largest: cluster sizes
+ *  - P_inf: largest / n_total, n_total being the undiluted cell count
+ *  - mean_size: sum(s^2)/sum(s) over clusters other than the wrapping ones
+ *  - largest_Rg: radius of gyration of the largest cluster, NaN if it
+ *    wraps or spans the supercell, as its unwrapped positions may then
+ *    depend on the path taken
+ */
+struct cluster_stats {
+    size_t n_clusters = 0;
+    size_t largest = 0;
+    size_t second_largest = 0;
+    double P_inf = 0;
+    double mean_size = 0;
+    double largest_Rg = 0;
     bool wraps = false;
 };
 
+template <typename C>
+inline cluster_stats summarise_clusters(const std::vector<C>& parts, uint64_t n_total){
+    const C* largest = nullptr;
+    cluster_stats res;
+    double s1 = 0, s2 = 0;
+    for (const auto& p : parts){
+        auto size = cluster_size(p);
+        if (largest == nullptr || size > cluster_size(*largest)){
+            if (largest != nullptr) res.second_largest = cluster_size(*largest);
+            largest = &p;
+        } else if (size > res.second_largest){
+            res.second_largest = size;
+        }
+        if (!p.wraps){
+            s1 += size;
+            s2 += double(size)*size;
+        }
+        res.wraps = res.wraps || p.wraps;
+    }
+
+    res.n_clusters = parts.size();
+    res.largest = largest ? cluster_size(*largest) : 0;
+    res.P_inf = double(res.largest) / n_total;
+    res.mean_size = s1 > 0 ? s2/s1 : 0.;
+    if (largest == nullptr) res.largest_Rg = 0.;
+    else if (largest->wraps || largest->spans) res.largest_Rg = std::nan("");
+    else res.largest_Rg = std::sqrt(largest->moments.Rg2(res.largest));
+    return res;
+}
+
 
 inline double calc_Lmin2(const imat33_t& cell_vectors){
     int64_t l2[3] = {0,0,0};
@@ -30,10 +186,42 @@ inline double calc_Lmin2(const imat33_t& cell_vectors){
     return std::min(l2[0], std::min(l2[1],l2[2]));
 }
 
+
+// Displacement from a to the nearest periodic image of b. Anything shorter
+// than half the shortest supercell vector is already the nearest image;
+// otherwise one translation per supercell vector is enough for neighbours.
+inline ipos_t min_image_disp(const imat33_t& cell_vectors, double Lmin2,
+        const ipos_t& a, const ipos_t& b){
+    ipos_t best = b - a;
+    auto norm2 = [](const ipos_t& x){ return x[0]*x[0] + x[1]*x[1] + x[2]*x[2]; };
+    auto best2 = norm2(best);
+    if (4*best2 < Lmin2) return best;
+
+    const ipos_t raw = best;
+    for (int i=-1; i<=1; i++){
+        for (int j=-1; j<=1; j++){
+            for (int k=-1; k<=1; k++){
+                ipos_t x = raw;
+                for (int c=0; c<3; c++){
+                    x[c] += i*cell_vectors(c,0) + j*cell_vectors(c,1) + k*cell_vectors(c,2);
+                }
+                auto x2 = norm2(x);
+                if (x2 < best2){
+                    best = x;
+                    best2 = x2;
+                }
+            }
+        }
+    }
+    return best;
+}
+
 template<Visitable T>
 inline std::vector<conn_components<T>> find_connected(
         CellGeometry::PeriodicAbstractLattice lat,
-		CellGeometry::SparseMap<CellGeometry::sl_t, T*>& elems
+		CellGeometry::SparseMap<CellGeometry::sl_t, T*>& elems,
+        bool stop_at_wrap=false,
+        const std::vector<T*>* order=nullptr
 		){
     /**
      * Starting from all points, either start a new cluster or expand cluster
@@ -41,10 +229,16 @@ inline std::vector<conn_components<T>> find_connected(
      * @param elems some collection of gometric objects, stored as a
      *                  Map from a sublattice index to a pointer to the element.
      *  @param Lmin The minimum physical distance that a wrapping cluster must cover. 
+     *  @param stop_at_wrap return once a cluster wraps, as the last of a
+     *                  partial list (only its flag is then meaningful)
+     *  @param order    if given, all of elems in the order to start clusters
+     *                  from, instead of the key order of elems; each cluster
+     *                  is rooted at its first member in this order
      */
 
 
-    std::stack<T*> stack;
+    // DFS stack, holding each cell with its unwrapped position
+    std::stack<std::pair<T*, ipos_t>, std::pmr::deque<std::pair<T*, ipos_t>>> stack;
     // Classic union-find algorithm. The Visitbale concept ensures that type T 
     // has a pointer "root" that can be used to keep track of cluster ownership.
     
@@ -54,48 +248,74 @@ inline std::vector<conn_components<T>> find_connected(
     }
 
     std::vector<conn_components<T>> component_list;
+
+    auto Lmin2 = calc_Lmin2(lat.cell_vectors);
+
+    auto test_wrap = [&](conn_components<T>& component){
+        component.spans = spans_supercell(component.moments, Lmin2);
+        if (component.elems.empty()) { return; }
+        auto root_cell = (*component.elems.begin())->root;
+        auto x0 = root_cell -> position;
+        
+        for (auto el = component.elems.rbegin(); 
+                el != component.elems.rend(); el++){
+            if (lat.d2((*el)->position, x0) > Lmin2/4) {
+                component.wraps = true;
+                break;
+            }
+        }
+    };
     
     // Iterate through all elements, eznsuring that everyone gets a visit. 
     // We "colour" each element with a non-null pointer to a root element
     // Each nullptr node we visit is therefore the beginning of a new cluster.
-    for (const auto& [_, root_cell] : elems){
-        if (root_cell->root != nullptr) continue; // already visited, skip
+    auto visit = [&](T* root_cell){
+        if (root_cell->root != nullptr) return false; // already visited, skip
 
         component_list.push_back({});
         auto& cell_union = component_list.back();
         
         // start a DFS
-        stack.push(root_cell);
+        stack.push({root_cell, root_cell->position});
         while(!stack.empty()){
-            auto curr = stack.top();
-            cell_union.elems.insert(curr);
+            WORK_COUNT(work_counters::peak(work.dfs_stack_peak[cell_dim<T>()], stack.size()));
+            auto [curr, x] = stack.top();
             stack.pop();
+            // cells may be stacked more than once before their first visit
+            if (curr->root != nullptr) continue;
+            cell_union.elems.push_back(curr);
+            cell_union.moments.add(x);
 
             curr->root = root_cell;
             for(auto next : CellGeometry::get_neighbours<T>(curr)){
+                WORK_COUNT(work.neighbour_visits[cell_dim<T>()]++);
                 if (next->root == nullptr){
-                    stack.push(next);
+                    stack.push({next, x + min_image_disp(lat.cell_vectors, Lmin2,
+                                curr->position, next->position)});
                 }
             }
         }
-    }
+        if (stop_at_wrap){
+            test_wrap(cell_union);
+            if (cell_union.wraps) return true;
+        }
+        return false;
+    };
 
-    auto Lmin2 = calc_Lmin2(lat.cell_vectors);
+    if (order != nullptr){
+        for (auto root_cell : *order){
+            if (visit(root_cell)) return component_list;
+        }
+    } else {
+        for (const auto& [_, root_cell] : elems){
+            if (visit(root_cell)) return component_list;
+        }
+    }
 
     // All components identified. Second pass: determine if these wrap
-    for (auto& component : component_list){
-        if (component.elems.empty()) { continue; }
-        auto root_cell = (*component.elems.begin())->root;
-        auto x0 = root_cell -> position;
-        
-        for (auto el = component.elems.rbegin(); 
-                el != component.elems.rend(); el++){
-//        for (auto el : component.elems) {
-            if (lat.d2((*el)->position, x0) > Lmin2/4) {
-                component.wraps = true;
-                break;
-            }
-        }
+    // (done for each component as it completes, with stop_at_wrap)
+    if (!stop_at_wrap){
+        for (auto& component : component_list) test_wrap(component);
     }
 
     return component_list;
@@ -0,0 +1,771 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include <UnitCellSpecifier.hpp>
+
+#include "diamond_tables.hpp"
+#include "geom_traverser.hpp"
+#include "work_counters.hpp"
+
+/**
+ * A diamond supercell that stores no adjacency at all.
+ *
+ * Every cell is addressed by id = (primitive cell index) * n_sl[dim] + sl,
+ * and its neighbours are recomputed from the diamond:: tables whenever they
+ * are needed. The only per-cell state is
+ *  - one liveness bit per link, plaq and vol (points are never deleted),
+ *  - scratch used by the defect search and the cluster finder.
+ *
+ * Erasing a link also erases every plaq containing it and every vol
+ * containing those plaqs, as PeriodicVolLattice::erase_link does. Bulk
+ * dilution instead defers this (defer_faces) and derives the plaqs and
+ * vols from the link bits in one pass at the end (derive_faces), so the
+ * three cluster analyses all follow from the one link mask.
+ */
+
+
+// Integer floor division, rounding towards -inf
+inline int64_t floordiv(int64_t a, int64_t b){
+    int64_t q = a / b;
+    return (a % b != 0 && ((a < 0) != (b < 0))) ? q - 1 : q;
+}
+
+
+/**
+ * Maps primitive cell coordinates onto a linear index within the supercell.
+ *
+ * The supercell translations Z.Z^3 are brought to the upper-triangular
+ * Hermite normal form H = Z U (U unimodular). Any n then has the unique
+ * representative 0 <= n_i < H(i,i), found by reducing n_3, n_2, n_1 in turn.
+ * The reduction of n_3 only uses the third column, so cells with equal n_3
+ * form slabs stacked along the third supercell vector.
+ *
+ * The canonical index of a representative is row-major,
+ * n_1 + H(1,1) (n_2 + H(2,2) n_3). With block > 0 (a power of two dividing
+ * every H(i,i)) cells are instead laid out in tiles of block^3, row-major
+ * within and between tiles, so that neighbours along every axis are close
+ * in memory. Dilution, defect order and cluster roots are all defined
+ * through the canonical index, so the layout never changes results.
+ */
+struct supercell_index {
+    int64_t H[3][3];
+    uint64_t n_cells;
+    int64_t block;
+    // log2(block), and the number of tiles along each axis
+    unsigned block_bits = 0;
+    int64_t n_tiles[3] = {0, 0, 0};
+
+    explicit supercell_index(const imat33_t& Z, unsigned block=0) : block(block) {
+        for (int i=0; i<3; i++){
+            for (int j=0; j<3; j++){
+                H[i][j] = Z(i,j);
+            }
+        }
+
+        auto col_axpy = [&](int dst, int src, int64_t q){
+            for (int i=0; i<3; i++) H[i][dst] -= q*H[i][src];
+        };
+        auto col_swap = [&](int a, int b){
+            for (int i=0; i<3; i++) std::swap(H[i][a], H[i][b]);
+        };
+
+        // Euclid's algorithm on the columns, clearing the lower triangle
+        for (int row=2; row>0; row--){
+            for (int j=0; j<row; j++){
+                while (H[row][j] != 0){
+                    if (H[row][row] != 0) col_axpy(j, row, H[row][j] / H[row][row]);
+                    if (H[row][j] != 0) col_swap(j, row);
+                }
+            }
+        }
+        for (int j=0; j<3; j++){
+            if (H[j][j] == 0){
+                throw std::invalid_argument("Supercell vectors are linearly dependent");
+            }
+            if (H[j][j] < 0){
+                for (int i=0; i<3; i++) H[i][j] = -H[i][j];
+            }
+        }
+        n_cells = H[0][0]*H[1][1]*H[2][2];
+
+        if (block != 0){
+            if (!std::has_single_bit(block)){
+                throw std::invalid_argument("Block size must be a power of two");
+            }
+            block_bits = std::countr_zero(block);
+            for (int i=0; i<3; i++){
+                if (H[i][i] % block != 0){
+                    throw std::invalid_argument("Block size must divide the supercell's HNF diagonal");
+                }
+                n_tiles[i] = H[i][i] / block;
+            }
+        }
+    }
+
+    // Reduces n in place to its representative, returns the lattice
+    // translation (in HNF columns) that was subtracted
+    inline void reduce(int64_t n[3], int64_t winding[3]) const {
+        for (int j=2; j>=0; j--){
+            winding[j] = floordiv(n[j], H[j][j]);
+            for (int i=0; i<=j; i++) n[i] -= winding[j]*H[i][j];
+        }
+    }
+
+    inline uint64_t index_of(const int64_t n[3]) const {
+        int64_t m[3] = {n[0], n[1], n[2]};
+        int64_t w[3];
+        reduce(m, w);
+        return index_in_box(m);
+    }
+
+    // Index of a representative, 0 <= m_i < H(i,i)
+    inline uint64_t index_in_box(const int64_t m[3]) const {
+        if (block == 0) return m[0] + H[0][0]*(m[1] + H[1][1]*m[2]);
+
+        const int64_t mask = block - 1;
+        const uint64_t tile = (m[0] >> block_bits)
+            + n_tiles[0]*((m[1] >> block_bits) + n_tiles[1]*(m[2] >> block_bits));
+        const uint64_t local = (m[0] & mask) | ((m[1] & mask) << block_bits)
+            | ((m[2] & mask) << 2*block_bits);
+        return (tile << 3*block_bits) | local;
+    }
+
+    inline void coords_of(uint64_t idx, int64_t n[3]) const {
+        if (block == 0){
+            n[0] = idx % H[0][0];
+            idx /= H[0][0];
+            n[1] = idx % H[1][1];
+            n[2] = idx / H[1][1];
+            return;
+        }
+
+        const int64_t mask = block - 1;
+        const int64_t tile = idx >> 3*block_bits;
+        n[0] = ((tile % n_tiles[0]) << block_bits) | (idx & mask);
+        n[1] = ((tile / n_tiles[0] % n_tiles[1]) << block_bits) | ((idx >> block_bits) & mask);
+        n[2] = ((tile / (n_tiles[0]*n_tiles[1])) << block_bits) | ((idx >> 2*block_bits) & mask);
+    }
+
+    // Index of the cell dn away from the cell at index idx. Steps that stay
+    // within the box (or tile) skip the reduction.
+    inline uint64_t offset_index(uint64_t idx, const int8_t dn[3]) const {
+        int64_t n[3];
+        if (block == 0){
+            n[0] = idx % H[0][0];
+            int64_t rest = idx / H[0][0];
+            n[1] = rest % H[1][1];
+            n[2] = rest / H[1][1];
+            bool inside = true;
+            for (int i=0; i<3; i++){
+                n[i] += dn[i];
+                inside = inside && n[i] >= 0 && n[i] < H[i][i];
+            }
+            if (inside) return idx + dn[0] + H[0][0]*(dn[1] + H[1][1]*dn[2]);
+            return index_of(n);
+        }
+
+        const int64_t mask = block - 1;
+        bool inside = true;
+        for (int i=0; i<3; i++){
+            const int64_t r = ((idx >> i*block_bits) & mask) + dn[i];
+            inside = inside && r >= 0 && r < block;
+        }
+        if (inside) return idx + dn[0] + block*(dn[1] + block*dn[2]);
+
+        coords_of(idx, n);
+        for (int i=0; i<3; i++) n[i] += dn[i];
+        return index_of(n);
+    }
+
+    // offset_index(idx, offs[k].dn) for every k < n, decomposing idx once
+    inline void offset_indices(uint64_t idx, const diamond::cell_offset* offs, unsigned n,
+            uint64_t* out) const {
+        int64_t c[3];
+        coords_of(idx, c);
+        const int64_t mask = block - 1;
+        for (unsigned k=0; k<n; k++){
+            const int8_t* dn = offs[k].dn;
+            bool inside = true;
+            for (int i=0; i<3; i++){
+                const int64_t r = (block == 0 ? c[i] : c[i] & mask) + dn[i];
+                inside = inside && r >= 0 && r < (block == 0 ? H[i][i] : block);
+            }
+            if (inside){
+                const int64_t w0 = block == 0 ? H[0][0] : block;
+                const int64_t w1 = block == 0 ? H[1][1] : block;
+                out[k] = idx + dn[0] + w0*(dn[1] + w1*dn[2]);
+            } else {
+                int64_t m[3] = {c[0] + dn[0], c[1] + dn[1], c[2] + dn[2]};
+                out[k] = index_of(m);
+            }
+        }
+    }
+
+    // Row-major index of the cell at index idx
+    inline uint64_t canonical_index(uint64_t idx) const {
+        if (block == 0) return idx;
+        int64_t n[3];
+        coords_of(idx, n);
+        return n[0] + H[0][0]*(n[1] + H[1][1]*n[2]);
+    }
+
+    inline uint64_t index_of_canonical(uint64_t c) const {
+        if (block == 0) return c;
+        int64_t n[3] = {int64_t(c % H[0][0]), int64_t(c / H[0][0] % H[1][1]),
+            int64_t(c / (H[0][0]*H[1][1]))};
+        return index_of(n);
+    }
+};
+
+
+// Geometry of a diamond supercell, without any per-cell state
+struct diamond_geometry {
+    supercell_index sc;
+
+    // real-space translations generating the supercell, as rows
+    int64_t T[3][3];
+    // squared length of the shortest supercell vector, cf. calc_Lmin2
+    double Lmin2;
+
+    explicit diamond_geometry(const imat33_t& Z, unsigned block=0) : sc(Z, block) {
+        if (sc.n_cells * n_sl(1) >= (uint64_t(1) << 32)){
+            throw std::length_error("Supercell too large for 32-bit cell ids");
+        }
+
+        // Lmin2 is defined from the supercell as specified, not its HNF
+        int64_t l2[3] = {0,0,0};
+        for (int j=0; j<3; j++){
+            for (int k=0; k<3; k++){
+                int64_t x = 0;
+                for (int i=0; i<3; i++) x += diamond::prim_vectors[i][k] * Z(i,j);
+                l2[j] += x*x;
+            }
+        }
+        Lmin2 = std::min(l2[0], std::min(l2[1], l2[2]));
+
+        for (int j=0; j<3; j++){
+            for (int k=0; k<3; k++){
+                T[j][k] = 0;
+                for (int i=0; i<3; i++) T[j][k] += diamond::prim_vectors[i][k] * sc.H[i][j];
+            }
+        }
+    }
+
+    static constexpr unsigned n_sl(int dim) { return diamond::n_sl[dim]; }
+
+    inline uint64_t size(int dim) const { return sc.n_cells * n_sl(dim); }
+
+    // Id of a cell in the row-major layout, which is what random draws,
+    // 'specific' ids and processing orders refer to
+    inline uint64_t canonical_id(int dim, uint64_t id) const {
+        return sc.canonical_index(id / n_sl(dim)) * n_sl(dim) + id % n_sl(dim);
+    }
+
+    inline uint64_t id_of_canonical(int dim, uint64_t c) const {
+        return sc.index_of_canonical(c / n_sl(dim)) * n_sl(dim) + c % n_sl(dim);
+    }
+
+    // The cell of dimension 'to_dim' reached from cell 'id' (dimension
+    // 'from_dim') via table entry o
+    inline uint32_t cell_at(uint64_t id, int from_dim, const diamond::cell_offset& o, int to_dim) const {
+        return sc.offset_index(id / n_sl(from_dim), o.dn) * n_sl(to_dim) + o.sl;
+    }
+
+    // cell_at for table entries offs[0..n), sharing the decomposition of id
+    inline void cells_at(uint64_t id, int from_dim, const diamond::cell_offset* offs, unsigned n,
+            int to_dim, uint64_t* out) const {
+        sc.offset_indices(id / n_sl(from_dim), offs, n, out);
+        for (unsigned k=0; k<n; k++) out[k] = out[k] * n_sl(to_dim) + offs[k].sl;
+    }
+
+    // Real-space displacement from a cell of dimension 'dim' on sublattice
+    // 'sl' to the cell reached via table entry o, of the same dimension
+    static ipos_t displacement(int dim, unsigned sl, const diamond::cell_offset& o){
+        int64_t x[3];
+        for (int k=0; k<3; k++){
+            x[k] = diamond::sl_position[dim][o.sl][k] - diamond::sl_position[dim][sl][k];
+            for (int i=0; i<3; i++) x[k] += o.dn[i]*diamond::prim_vectors[i][k];
+        }
+        return ipos_t{x[0], x[1], x[2]};
+    }
+
+    ipos_t position(int dim, uint64_t id) const {
+        int64_t n[3];
+        sc.coords_of(id / n_sl(dim), n);
+        const auto& b = diamond::sl_position[dim][id % n_sl(dim)];
+        int64_t x[3];
+        for (int k=0; k<3; k++){
+            x[k] = b[k];
+            for (int i=0; i<3; i++) x[k] += n[i]*diamond::prim_vectors[i][k];
+        }
+        return ipos_t{x[0], x[1], x[2]};
+    }
+
+    // Inverse of position(); throws std::out_of_range if R is not a cell
+    // of dimension 'dim'
+    uint32_t cell_at_position(int dim, const ipos_t& R) const {
+        for (unsigned sl=0; sl<n_sl(dim); sl++){
+            int64_t x[3];
+            for (int k=0; k<3; k++) x[k] = R[k] - diamond::sl_position[dim][sl][k];
+            // inverse of the primitive vectors, times 8
+            int64_t n8[3] = {-x[0]+x[1]+x[2], x[0]-x[1]+x[2], x[0]+x[1]-x[2]};
+            if (n8[0] % 8 || n8[1] % 8 || n8[2] % 8) continue;
+            int64_t n[3] = {n8[0]/8, n8[1]/8, n8[2]/8};
+            return sc.index_of(n) * n_sl(dim) + sl;
+        }
+        throw std::out_of_range("No cell at requested position");
+    }
+
+    // Squared minimum-image distance between cells a and b of dimension dim
+    int64_t d2(int dim, uint64_t a, uint64_t b) const {
+        int64_t na[3], nb[3];
+        sc.coords_of(a / n_sl(dim), na);
+        sc.coords_of(b / n_sl(dim), nb);
+        int64_t dn[3] = {nb[0]-na[0], nb[1]-na[1], nb[2]-na[2]};
+        int64_t w[3];
+        sc.reduce(dn, w);
+
+        const auto& pa = diamond::sl_position[dim][a % n_sl(dim)];
+        const auto& pb = diamond::sl_position[dim][b % n_sl(dim)];
+        int64_t r[3];
+        for (int k=0; k<3; k++){
+            r[k] = pb[k] - pa[k];
+            for (int i=0; i<3; i++) r[k] += dn[i]*diamond::prim_vectors[i][k];
+        }
+
+        int64_t best = INT64_MAX;
+        for (int i=-1; i<=1; i++){
+            for (int j=-1; j<=1; j++){
+                for (int k=-1; k<=1; k++){
+                    int64_t s = 0;
+                    for (int c=0; c<3; c++){
+                        int64_t x = r[c] + i*T[0][c] + j*T[1][c] + k*T[2][c];
+                        s += x*x;
+                    }
+                    best = std::min(best, s);
+                }
+            }
+        }
+        return best;
+    }
+};
+
+
+/**
+ * The links bounding the plaqs and vols of one primitive cell all lie in a
+ * fixed set of nearby cells. With the 4 link-liveness bits of each of them
+ * packed into one word, a plaq or vol is alive iff all of its link bits are
+ * set in the word.
+ */
+struct face_link_masks {
+    diamond::cell_offset cells[8] = {};  // sl unused
+    unsigned n_cells = 0;
+    uint32_t plaq[4] = {};
+    uint32_t vol[2] = {};
+};
+
+constexpr face_link_masks make_face_link_masks(){
+    face_link_masks m;
+    auto bit = [&m](int dn0, int dn1, int dn2, unsigned sl){
+        unsigned k = 0;
+        while (k < m.n_cells && !(m.cells[k].dn[0] == dn0 && m.cells[k].dn[1] == dn1
+                    && m.cells[k].dn[2] == dn2)) k++;
+        if (k == m.n_cells) m.cells[m.n_cells++] = {{int8_t(dn0), int8_t(dn1), int8_t(dn2)}, 0, 0};
+        return uint32_t(1) << (4*k + sl);
+    };
+    for (unsigned p=0; p<4; p++){
+        for (const auto& o : diamond::plaq_boundary[p]) m.plaq[p] |= bit(o.dn[0], o.dn[1], o.dn[2], o.sl);
+    }
+    for (unsigned v=0; v<2; v++){
+        for (const auto& f : diamond::vol_boundary[v]){
+            for (const auto& o : diamond::plaq_boundary[f.sl]){
+                m.vol[v] |= bit(f.dn[0]+o.dn[0], f.dn[1]+o.dn[1], f.dn[2]+o.dn[2], o.sl);
+            }
+        }
+    }
+    return m;
+}
+
+inline constexpr face_link_masks face_links = make_face_link_masks();
+static_assert(face_links.n_cells <= 8, "Face link masks must fit 32 bits");
+static_assert([]{
+    for (unsigned k=0; k<face_links.n_cells; k++){
+        for (int i=0; i<3; i++) if (face_links.cells[k].dn[i] < 0) return false;
+    }
+    return true;
+}(), "derive_faces assumes the face links lie at nonnegative offsets");
+
+
+struct implicit_diamond : public diamond_geometry {
+    // bit-packed liveness of links (1), plaqs (2) and vols (3)
+    std::vector<uint64_t> alive[4];
+
+    // Set while erase_link leaves plaqs and vols to derive_faces()
+    bool faces_deferred = false;
+
+    // Per-link mark of the defect search that traversed it (point id + 1),
+    // the analogue of Spin::origin
+    std::vector<uint32_t> origin;
+
+    // Per-cell cluster labels, shared by all dimensions
+    std::vector<uint32_t> label;
+
+    explicit implicit_diamond(const imat33_t& Z, unsigned block=0) : diamond_geometry(Z, block) {
+        reset();
+    }
+
+    // Brings every cell back to life and clears the scratch, so the lattice
+    // can be diluted again
+    void reset(){
+        for (int dim=1; dim<4; dim++){
+            auto n = size(dim);
+            alive[dim].assign((n + 63)/64, ~uint64_t(0));
+            if (n % 64) alive[dim].back() = (uint64_t(1) << (n % 64)) - 1;
+        }
+        origin.assign(size(1), 0);
+        label.clear();
+        faces_deferred = false;
+    }
+
+    inline bool is_alive(int dim, uint64_t id) const {
+        if (dim == 0) return true;
+        return (alive[dim][id >> 6] >> (id & 63)) & 1;
+    }
+
+    inline void kill(int dim, uint64_t id){
+        alive[dim][id >> 6] &= ~(uint64_t(1) << (id & 63));
+    }
+
+    inline uint64_t count_alive(int dim) const {
+        if (dim == 0) return size(0);
+        uint64_t n = 0;
+        for (auto w : alive[dim]) n += std::popcount(w);
+        return n;
+    }
+
+    // Number of live links around point 'pt'
+    inline unsigned coordination(uint64_t pt) const {
+        unsigned c = 0;
+        for (const auto& o : diamond::point_coboundary[pt % 2]){
+            c += is_alive(1, cell_at(pt, 0, o, 1));
+        }
+        return c;
+    }
+
+    void erase_link(uint64_t l){
+        WORK_COUNT(work.erase_link_calls++);
+        if (!is_alive(1, l)) return;
+        kill(1, l);
+        if (faces_deferred) return;
+        for (const auto& o : diamond::link_coboundary[l % 4]){
+            auto p = cell_at(l, 1, o, 2);
+            if (!is_alive(2, p)) continue;
+            kill(2, p);
+            for (const auto& o2 : diamond::plaq_coboundary[p % 4]){
+                kill(3, cell_at(p, 2, o2, 3));
+            }
+        }
+    }
+
+    // Makes erase_link erase links only, until derive_faces()
+    inline void defer_faces(){ faces_deferred = true; }
+
+    /**
+     * Recomputes the liveness of every plaq and vol from that of the links,
+     * one primitive cell at a time: the link bits of the cells in
+     * face_links are gathered into a word, and each plaq and vol of the
+     * cell tested against its mask. Gives what erase_link's cascade would.
+     */
+    void derive_faces(){
+        static_assert(diamond::n_sl[1] == 4 && diamond::n_sl[2] == 4 && diamond::n_sl[3] == 2);
+        const auto& m = face_links;
+        std::fill(alive[2].begin(), alive[2].end(), 0);
+        std::fill(alive[3].begin(), alive[3].end(), 0);
+
+        // cells are visited by their coordinates, so that neighbours inside
+        // the box need no reduction
+        int64_t c[3];
+        for (c[2]=0; c[2]<sc.H[2][2]; c[2]++){
+            for (c[1]=0; c[1]<sc.H[1][1]; c[1]++){
+                for (c[0]=0; c[0]<sc.H[0][0]; c[0]++){
+                    const uint64_t n = sc.index_in_box(c);
+                    uint32_t word = 0;
+                    for (unsigned k=0; k<m.n_cells; k++){
+                        const auto& dn = m.cells[k].dn;
+                        int64_t x[3] = {c[0] + dn[0], c[1] + dn[1], c[2] + dn[2]};
+                        const bool inside = x[0] < sc.H[0][0] && x[1] < sc.H[1][1] && x[2] < sc.H[2][2];
+                        const uint64_t nb = inside ? sc.index_in_box(x) : sc.index_of(x);
+                        word |= uint32_t((alive[1][nb >> 4] >> (4*(nb & 15))) & 15) << 4*k;
+                    }
+                    uint64_t plaqs = 0, vols = 0;
+                    for (unsigned sl=0; sl<4; sl++){
+                        plaqs |= uint64_t((word & m.plaq[sl]) == m.plaq[sl]) << sl;
+                    }
+                    for (unsigned sl=0; sl<2; sl++){
+                        vols |= uint64_t((word & m.vol[sl]) == m.vol[sl]) << sl;
+                    }
+                    alive[2][n >> 4] |= plaqs << (4*(n & 15));
+                    alive[3][n >> 5] |= vols << (2*(n & 31));
+                }
+            }
+        }
+        faces_deferred = false;
+    }
+};
+
+
+/////////////////////////////////
+/// CLUSTER FINDING /////////////
+
+// Offsets from a cell to every cell sharing one of its faces, excluding
+// itself. Duplicates (e.g. hexagons sharing two links) are removed.
+inline std::vector<diamond::cell_offset> face_neighbour_offsets(int dim, unsigned sl){
+    std::vector<diamond::cell_offset> res;
+    auto add_via = [&](const diamond::cell_offset& f, const auto& cob){
+        for (const auto& c : cob){
+            diamond::cell_offset o = {{int8_t(f.dn[0]+c.dn[0]), int8_t(f.dn[1]+c.dn[1]),
+                int8_t(f.dn[2]+c.dn[2])}, c.sl, 1};
+            if (o.sl == sl && o.dn[0] == 0 && o.dn[1] == 0 && o.dn[2] == 0) continue;
+            bool seen = std::any_of(res.begin(), res.end(), [&](const auto& x){
+                return x.sl == o.sl && x.dn[0] == o.dn[0] && x.dn[1] == o.dn[1] && x.dn[2] == o.dn[2];
+            });
+            if (!seen) res.push_back(o);
+        }
+    };
+    switch (dim){
+        case 1:
+            for (const auto& f : diamond::link_boundary[sl]) add_via(f, diamond::point_coboundary[f.sl]);
+            break;
+        case 2:
+            for (const auto& f : diamond::plaq_boundary[sl]) add_via(f, diamond::link_coboundary[f.sl]);
+            break;
+        case 3:
+            for (const auto& f : diamond::vol_boundary[sl]) add_via(f, diamond::plaq_coboundary[f.sl]);
+            break;
+        default:
+            throw std::logic_error("Points have no faces");
+    }
+    return res;
+}
+
+
+// Number of face neighbours of every link, plaq and vol
+inline constexpr unsigned face_degree[4] = {0, 6, 24, 4};
+
+// face_neighbour_offsets of every sublattice, as rows of fixed length
+template<int dim>
+inline auto face_neighbour_table(){
+    std::array<std::array<diamond::cell_offset, face_degree[dim]>, diamond::n_sl[dim]> res;
+    for (unsigned sl=0; sl<diamond::n_sl[dim]; sl++){
+        const auto o = face_neighbour_offsets(dim, sl);
+        if (o.size() != face_degree[dim]){
+            throw std::logic_error("Face neighbours disagree with face_degree");
+        }
+        std::copy(o.begin(), o.end(), res[sl].begin());
+    }
+    return res;
+}
+
+
+/**
+ * Counterpart of find_connected for the implicit lattice: DFS over live
+ * cells of dimension 'dim', connected when they share a face. The face_degree
+ * neighbours of a cell are found together (cells_at). Cells are
+ * visited in id order, and a cluster wraps if any member lies further than
+ * sqrt(Lmin2)/2 from the cell its search started from.
+ * Moments are taken over positions unwrapped along the search.
+ * Labels (1-based cluster index) are left in lat.label.
+ *
+ * With a blocked layout the search starts elsewhere, so members are kept
+ * to test wrapping against the cluster's lowest canonical id instead,
+ * moments are moved into that cell's frame, and clusters are put back in
+ * canonical order at the end. Unless the cluster winds around the
+ * supercell, this gives the row-major moments exactly (they are sums of
+ * integers).
+ *
+ * With stop_at_wrap, returns as soon as a cluster is known to wrap, which
+ * is then the last of the list; the list and labels are otherwise partial,
+ * and only whether the last cluster wraps is meaningful.
+ */
+template<int dim>
+inline std::vector<cluster_summary> find_connected(implicit_diamond& lat, bool stop_at_wrap=false){
+    static_assert(dim >= 1 && dim <= 3, "Only links, plaqs and vols are clustered");
+    constexpr unsigned nsl = implicit_diamond::n_sl(dim);
+    constexpr unsigned degree = face_degree[dim];
+
+    const auto nbrs = face_neighbour_table<dim>();
+    ipos_t nbr_disp[nsl][degree];
+    for (unsigned sl=0; sl<nsl; sl++){
+        for (unsigned j=0; j<degree; j++){
+            nbr_disp[sl][j] = implicit_diamond::displacement(dim, sl, nbrs[sl][j]);
+        }
+    }
+
+    const uint64_t N = lat.size(dim);
+    lat.label.assign(N, 0);
+
+    std::vector<cluster_summary> component_list;
+    std::vector<std::pair<uint32_t, ipos_t>> stack;
+
+    const bool blocked = lat.sc.block != 0;
+    std::vector<uint32_t> members;
+    std::vector<uint64_t> canonical_root;
+    uint64_t root = 0;
+    ipos_t root_x;
+
+    for (uint64_t root_cell=0; root_cell<N; root_cell++){
+        if (!lat.is_alive(dim, root_cell) || lat.label[root_cell] != 0) continue;
+
+        component_list.push_back({});
+        auto& cell_union = component_list.back();
+        const uint32_t c = component_list.size();
+        members.clear();
+
+        lat.label[root_cell] = c;
+        stack.push_back({root_cell, lat.position(dim, root_cell)});
+        while (!stack.empty()){
+            WORK_COUNT(work_counters::peak(work.dfs_stack_peak[dim], stack.size()));
+            auto [curr, x] = stack.back();
+            stack.pop_back();
+            cell_union.size++;
+            cell_union.moments.add(x);
+            if (blocked){
+                members.push_back(curr);
+                const auto id = lat.canonical_id(dim, curr);
+                if (members.size() == 1 || id < root){
+                    root = id;
+                    root_x = x;
+                }
+            } else if (!cell_union.wraps && lat.d2(dim, curr, root_cell) > lat.Lmin2/4){
+                cell_union.wraps = true;
+                if (stop_at_wrap) return component_list;
+            }
+
+            const unsigned sl = curr % nsl;
+            uint64_t next_ids[degree];
+            lat.cells_at(curr, dim, nbrs[sl].data(), degree, dim, next_ids);
+            for (unsigned j=0; j<degree; j++){
+                const auto next = next_ids[j];
+                WORK_COUNT(work.neighbour_visits[dim]++);
+                if (lat.label[next] == 0 && lat.is_alive(dim, next)){
+                    lat.label[next] = c;
+                    stack.push_back({next, x + nbr_disp[sl][j]});
+                }
+            }
+        }
+
+        if (blocked){
+            const auto root_id = lat.id_of_canonical(dim, root);
+            cluster_moments m;
+            m.merge(cell_union.moments, cell_union.size, lat.position(dim, root_id) - root_x);
+            cell_union.moments = m;
+            for (auto m : members){
+                if (lat.d2(dim, m, root_id) > lat.Lmin2/4){
+                    cell_union.wraps = true;
+                    break;
+                }
+            }
+            if (stop_at_wrap && cell_union.wraps) return component_list;
+            canonical_root.push_back(root);
+        }
+        cell_union.spans = spans_supercell(cell_union.moments, lat.Lmin2);
+    }
+
+    if (blocked){
+        std::vector<uint32_t> order(component_list.size());
+        for (uint32_t i=0; i<order.size(); i++) order[i] = i;
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){
+            return canonical_root[a] < canonical_root[b];
+        });
+        std::vector<uint32_t> new_label(order.size() + 1, 0);
+        std::vector<cluster_summary> sorted(order.size());
+        for (uint32_t i=0; i<order.size(); i++){
+            sorted[i] = component_list[order[i]];
+            new_label[order[i] + 1] = i + 1;
+        }
+        component_list = std::move(sorted);
+        for (auto& l : lat.label) l = new_label[l];
+    }
+
+    return component_list;
+}
+
+
+/////////////////////////////////
+/// DEFECT SEARCH ///////////////
+
+// Breadth-first search tree node; paths are recovered by walking 'parent'
+struct implicit_search_node {
+    uint32_t point;
+    uint32_t link;   // link used to reach 'point'
+    uint32_t parent; // index into the tree
+    uint32_t depth;
+};
+
+/**
+ * Counterpart of find_defect_tree for the implicit lattice: breadth-first
+ * search of all paths of up to max_len links from point 'orig', pruning
+ * links already traversed by this origin via lat.origin.
+ * @param tree: overwritten with the search tree, rooted at tree[0]
+ */
+inline void find_defect_tree(
+        implicit_diamond& lat, uint32_t orig, unsigned max_len,
+        std::vector<implicit_search_node>& tree){
+    const uint32_t mark = orig + 1;
+
+    tree.clear();
+    tree.push_back({orig, 0, 0, 0});
+    WORK_COUNT(work.bfs_pushed++);
+
+    for (size_t head=0; head<tree.size(); head++){
+        WORK_COUNT(work.bfs_popped++,
+                work_counters::peak(work.bfs_peak_queue, tree.size() - head));
+        const auto curr = tree[head];
+        if (curr.depth == max_len) continue;
+
+        for (const auto& o : diamond::point_coboundary[curr.point % 2]){
+            auto l = lat.cell_at(curr.point, 0, o, 1);
+            if (!lat.is_alive(1, l) || lat.origin[l] == mark) continue;
+            lat.origin[l] = mark;
+            for (const auto& b : diamond::link_boundary[l % 4]){
+                auto p2 = lat.cell_at(l, 1, b, 0);
+                if (p2 != curr.point){
+                    tree.push_back({p2, l, uint32_t(head), curr.depth+1});
+                    WORK_COUNT(work.bfs_pushed++);
+                }
+            }
+        }
+    }
+}
+
+// As clear_defect_tree
+inline void clear_defect_tree(implicit_diamond& lat,
+        const std::vector<implicit_search_node>& tree){
+    for (size_t i=1; i<tree.size(); i++) lat.origin[tree[i].link] = 0;
+}
+
+/**
+ * The paths of exactly 'len' links in a search tree that end on an
+ * under-coordinated point, as lists of link ids.
+ */
+inline std::vector<std::vector<uint32_t>> find_defect_links(
+        const implicit_diamond& lat, const std::vector<implicit_search_node>& tree,
+        unsigned len){
+    std::vector<std::vector<uint32_t>> res;
+    for (size_t i=0; i<tree.size(); i++){
+        if (tree[i].depth != len || lat.coordination(tree[i].point) >= 4) continue;
+
+        std::vector<uint32_t> path(len);
+        auto idx = i;
+        for (unsigned k=len; k-- > 0;){
+            path[k] = tree[idx].link;
+            idx = tree[idx].parent;
+        }
+        res.push_back(std::move(path));
+    }
+    return res;
+}
@@ -0,0 +1,201 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <XoshiroCpp.hpp>
+
+#include "counter_rng.hpp"
+#include "dilution.hpp"
+#include "implicit_diamond.hpp"
+#include "work_counters.hpp"
+
+/**
+ * The stages of a realisation on the implicit lattice (dilution, defect
+ * excision, cluster finding), shared by dmnd_dilute's implicit engine and
+ * libdmnd.
+ */
+
+
+// The requested path lengths, in the (increasing) order they are excised
+inline std::vector<int> search_lengths(std::vector<int> neighbours){
+    sort_and_remove_duplicates(neighbours);
+    if (!neighbours.empty() && neighbours.front() < 1){
+        throw std::invalid_argument("Path lengths must be positive");
+    }
+    return neighbours;
+}
+
+
+/**
+ * As determine_deleted_spins, for the implicit lattice, returning the ids
+ * of the links to delete in increasing order. 'random' uses the
+ * counter-based draws of streamed_dilution, so a given seed yields a
+ * different realisation than with the reference lattice (but the same as
+ * the streaming engine); 'specific' ids are implicit link ids. Draws and
+ * ids refer to canonical ids, so the realisation does not depend on the
+ * layout.
+ */
+inline std::vector<uint32_t> deleted_links(
+        const implicit_diamond& lat, uint64_t seed,
+        const std::string& erase_strat,
+        double dilution_prob,
+        const std::vector<int>& spin_ids_to_delete
+        ){
+    std::vector<uint32_t> links_to_yeet;
+    XoshiroCpp::Xoshiro256PlusPlus gen(seed);
+
+    if (erase_strat == "random"){
+        for (uint64_t l=0; l<lat.size(1); l++) {
+            if (counter_bernoulli(seed, lat.canonical_id(1, l), dilution_prob)) links_to_yeet.push_back(l);
+        }
+    } else if (erase_strat == "Zr4") {
+        std::bernoulli_distribution d_O2(dilution_prob/2);
+        std::vector<uint32_t> stuffed_dual_tetras;
+        for (uint64_t c=0; c<lat.size(3); c++) {
+            if (d_O2(gen)) stuffed_dual_tetras.push_back(lat.id_of_canonical(3, c));
+        }
+
+        auto _mu_set = mu_set;
+        std::unordered_set<uint32_t> chosen;
+
+        for (auto v : stuffed_dual_tetras){
+            const auto R0 = lat.position(3, v);
+            int vol_sl = v % implicit_diamond::n_sl(3);
+
+            std::shuffle(_mu_set.begin(), _mu_set.end(), gen);
+
+            for (int i=0; i<24; i++){
+                auto& mu = _mu_set[i];
+                const auto& R1 = R0 - (1 - 2*vol_sl) * ( 2* pyro_r[mu[0]] + pyro_r[mu[1]]);
+                const auto& R2 = R0 - (1 - 2*vol_sl) * ( 2* pyro_r[mu[2]] + pyro_r[mu[3]]);
+                auto s1 = lat.cell_at_position(1, R1);
+                auto s2 = lat.cell_at_position(1, R2);
+
+                if (!(chosen.contains(s1) || chosen.contains(s2))){
+                    chosen.insert(s1);
+                    chosen.insert(s2);
+                    links_to_yeet.push_back(s1);
+                    links_to_yeet.push_back(s2);
+                    break;
+                }
+            }
+        }
+    } else if (erase_strat == "specific"){
+        for (auto& x : spin_ids_to_delete){
+            if (x < 0 || uint64_t(x) >= lat.size(1)){
+                throw std::out_of_range("Tried to delete spins at nonexistent index");
+            }
+            links_to_yeet.push_back(lat.id_of_canonical(1, x));
+        }
+    } else { throw std::logic_error("bad dilution strategy"); }
+
+    std::sort(links_to_yeet.begin(), links_to_yeet.end());
+    links_to_yeet.erase(std::unique(links_to_yeet.begin(), links_to_yeet.end()),
+            links_to_yeet.end());
+    return links_to_yeet;
+}
+
+
+// As excise_defect_paths, for the implicit lattice
+inline std::vector<uint32_t> excise_defect_paths(
+        implicit_diamond& lat,
+        const std::vector<uint32_t>& defects,
+        const std::vector<int>& lens,
+        std::map<size_t, size_t>& n_dimers,
+        bool verbose=true,
+        size_t* n_visited=nullptr
+        ){
+    std::vector<uint32_t> new_defects;
+    unsigned total_n = defects.size();
+    std::vector<implicit_search_node> tree;
+
+    for (auto len : lens){
+        if (verbose) printf("[search] excising %d neighbours\n", len);
+
+        n_dimers[len] = 0;
+        for (unsigned i=0; i<total_n; i++){
+            find_defect_tree(lat, defects[i], len, tree);
+            if (n_visited) *n_visited += tree.size();
+            auto links = find_defect_links(lat, tree, len);
+            clear_defect_tree(lat, tree);
+
+            n_dimers[len] += links.size();
+            WORK_COUNT(work.paths_found[len] += links.size());
+            for (const auto& path : links){
+                WORK_COUNT(if (std::any_of(path.begin(), path.end(), [&](uint32_t l){
+                            return lat.is_alive(1, l); }))
+                        work.paths_excised[len]++);
+                for (auto l : path){
+                    if (!lat.is_alive(1, l)) continue;
+                    for (const auto& b : diamond::link_boundary[l % 4]){
+                        auto pt = lat.cell_at(l, 1, b, 0);
+                        if (lat.coordination(pt) == 4) new_defects.push_back(pt);
+                    }
+                    lat.erase_link(l);
+                }
+            }
+
+            if (verbose){
+                printf("%5d / %5d (%02d%%)\r", i, total_n, i * 100 / total_n);
+                fflush(stdout);
+            }
+        }
+        if (verbose) printf("\n");
+    }
+    return new_defects;
+}
+
+
+/**
+ * Erases 'links_to_yeet' and excises the defect paths of lengths 'lens'
+ * from the tetras it leaves under-coordinated, searched in canonical order;
+ * with 'cascade', again from the defects each round creates until there are
+ * none. Returns the path counts of each round; n_visited, if given, is
+ * incremented by the points the searches visit. Plaqs and vols are only
+ * updated at the end, from the surviving links (derive_faces), and not at
+ * all without 'faces' (their bits are then stale).
+ */
+inline std::vector<std::map<size_t, size_t>> dilute_and_excise(
+        implicit_diamond& lat,
+        const std::vector<uint32_t>& links_to_yeet,
+        const std::vector<int>& lens,
+        bool cascade,
+        bool verbose=true,
+        size_t* n_visited=nullptr,
+        bool faces=true
+        ){
+    lat.defer_faces();
+    std::vector<uint32_t> defect_tetras;
+    for (auto l : links_to_yeet){
+        for (const auto& b : diamond::link_boundary[l % 4]){
+            defect_tetras.push_back(lat.cell_at(l, 1, b, 0));
+        }
+        lat.erase_link(l);
+    }
+    // defects are searched in canonical order, whatever the layout
+    std::sort(defect_tetras.begin(), defect_tetras.end(), [&](uint32_t a, uint32_t b){
+        return lat.canonical_id(0, a) < lat.canonical_id(0, b);
+    });
+    defect_tetras.erase(unique(defect_tetras.begin(), defect_tetras.end()),
+            defect_tetras.end());
+
+    std::vector<std::map<size_t, size_t>> n_dimers;
+
+    auto worklist = defect_tetras;
+    do {
+        if (verbose && !n_dimers.empty()){
+            printf("[cascade] generation %zu: %zu new defects\n", n_dimers.size(), worklist.size());
+        }
+        n_dimers.emplace_back();
+        worklist = excise_defect_paths(lat, worklist, lens, n_dimers.back(), verbose, n_visited);
+    } while (cascade && !worklist.empty());
+
+    if (faces) lat.derive_faces();
+    return n_dimers;
+}
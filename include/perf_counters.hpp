@@ -0,0 +1,204 @@
+#pragma once
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Hardware counters of the calling thread, read through perf_event_open:
+ * cycles, instructions, last-level cache misses and branch misses, in user
+ * space only (so perf_event_paranoid up to 2 suffices).
+ *
+ * Each event is opened on its own, so a machine lacking one (a VM without
+ * an LLC event, say) still reports the others. Where none can be opened
+ * (no PMU, a seccomp filter, another OS) every reading is marked invalid
+ * and the reports say "n/a"; nothing fails. When the kernel multiplexes
+ * the events, readings are scaled by the fraction of time each was live.
+ */
+
+namespace perf_counters {
+
+enum event { cycles, instructions, llc_misses, branch_misses, n_events };
+
+inline const char* event_name(int e){
+    static const char* names[n_events] = {
+        "cycles", "instructions", "LLC misses", "branch misses"};
+    return names[e];
+}
+
+// Counter values, each valid only if its event could be opened
+struct reading {
+    uint64_t value[n_events] = {};
+    bool valid[n_events] = {};
+
+    reading& operator+=(const reading& o){
+        for (int e=0; e<n_events; e++){
+            value[e] += o.value[e];
+            valid[e] = valid[e] || o.valid[e];
+        }
+        return *this;
+    }
+};
+
+inline reading operator-(const reading& a, const reading& b){
+    reading res;
+    for (int e=0; e<n_events; e++){
+        res.valid[e] = a.valid[e] && b.valid[e];
+        res.value[e] = res.valid[e] && a.value[e] > b.value[e] ? a.value[e] - b.value[e] : 0;
+    }
+    return res;
+}
+
+
+class counters {
+public:
+    counters(){
+        for (int e=0; e<n_events; e++) fd[e] = open_event(e);
+    }
+
+    ~counters(){
+#ifdef __linux__
+        for (int e=0; e<n_events; e++) if (fd[e] >= 0) close(fd[e]);
+#endif
+    }
+
+    counters(const counters&) = delete;
+    counters& operator=(const counters&) = delete;
+
+    bool available() const {
+        for (int e=0; e<n_events; e++) if (fd[e] >= 0) return true;
+        return false;
+    }
+
+    // Why the first unavailable event could not be opened, or ""
+    const std::string& error() const { return why; }
+
+    // Cumulative counts since construction
+    reading read() const {
+        reading res;
+#ifdef __linux__
+        for (int e=0; e<n_events; e++){
+            if (fd[e] < 0) continue;
+            uint64_t buf[3]; // value, time enabled, time running
+            if (::read(fd[e], buf, sizeof(buf)) != sizeof(buf)) continue;
+            res.valid[e] = true;
+            res.value[e] = buf[2] == 0 ? 0 :
+                buf[2] < buf[1] ? uint64_t(double(buf[0]) * buf[1] / buf[2]) : buf[0];
+        }
+#endif
+        return res;
+    }
+
+private:
+    int fd[n_events];
+    std::string why;
+
+    int open_event(int e){
+#ifdef __linux__
+        static const uint64_t configs[n_events] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[e];
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        int res = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (res < 0 && why.empty()){
+            why = std::string(event_name(e)) + ": " + strerror(errno);
+        }
+        return res;
+#else
+        if (why.empty()) why = "perf_event_open needs Linux";
+        (void)e;
+        return -1;
+#endif
+    }
+};
+
+
+// An event's count, per cell if n_cells is nonzero, or "n/a"
+inline std::string format_event(const reading& r, int e, uint64_t n_cells){
+    if (!r.valid[e]) return "n/a";
+    char buf[32];
+    if (n_cells == 0) snprintf(buf, sizeof(buf), "%.4g", double(r.value[e]));
+    else snprintf(buf, sizeof(buf), "%.4f", double(r.value[e]) / n_cells);
+    return buf;
+}
+
+/**
+ * Prints one line per measured interval,
+ * "[perf] <name>: <c> cycles, <i> instructions, IPC <i/c>, <x> LLC misses/cell, <y> branch misses/cell",
+ * misses being per cell of the n_cells the interval visited (totals if 0)
+ */
+inline void print(const char* name, const reading& r, uint64_t n_cells){
+    std::string ipc = "n/a";
+    if (r.valid[cycles] && r.valid[instructions] && r.value[cycles] > 0){
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.3f", double(r.value[instructions]) / r.value[cycles]);
+        ipc = buf;
+    }
+    const char* unit = n_cells == 0 ? "" : "/cell";
+    printf("[perf] %s: %s cycles, %s instructions, IPC %s, %s LLC misses%s, %s branch misses%s\n",
+            name, format_event(r, cycles, 0).c_str(),
+            format_event(r, instructions, 0).c_str(), ipc.c_str(),
+            format_event(r, llc_misses, n_cells).c_str(), unit,
+            format_event(r, branch_misses, n_cells).c_str(), unit);
+}
+
+
+/**
+ * Counts accumulated under a name over many intervals, for kernels that
+ * run once per sweep (the Monte Carlo move types, say):
+ *     acc.begin(); ... acc.end("angle", n_links);
+ * and finally acc.report().
+ */
+class accumulator {
+public:
+    explicit accumulator(const counters& c) : c(c) {}
+
+    void begin(){ t0 = c.read(); }
+
+    void end(const std::string& name, uint64_t n_cells){
+        auto& t = totals[name];
+        t.counts += c.read() - t0;
+        t.n_cells += n_cells;
+        t.n_calls++;
+    }
+
+    void report() const {
+        if (!c.available()){
+            printf("[perf] hardware counters unavailable (%s)\n", c.error().c_str());
+            return;
+        }
+        for (const auto& [name, t] : totals){
+            print((name + " x" + std::to_string(t.n_calls)).c_str(), t.counts, t.n_cells);
+        }
+    }
+
+private:
+    struct total {
+        reading counts;
+        uint64_t n_cells = 0;
+        uint64_t n_calls = 0;
+    };
+
+    const counters& c;
+    reading t0;
+    std::map<std::string, total> totals;
+};
+
+} // end namespace perf_counters
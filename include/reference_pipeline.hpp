@@ -0,0 +1,254 @@
+#pragma once
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <memory_resource>
+#include <vector>
+
+// LatticeLab
+#include <chain.hpp>
+#include <cell_geometry.hpp>
+
+#include "cell_set.hpp"
+#include "implicit_diamond.hpp"
+#include "work_counters.hpp"
+
+/**
+ * The defect excision of the reference engine, on latticelab's
+ * PeriodicVolLattice, shared by dmnd_dilute and dmnd_crosscheck.
+ */
+
+
+// 'index' numbers points and links in the key order of their SparseMap,
+// see index_cells; 'sl' is their sublattice in the implicit engine's
+// numbering, see index_sublattices
+struct Tetra : public CellGeometry::Cell<0> {
+    uint32_t index = 0;
+    uint8_t sl = 0;
+};
+
+struct Spin : public CellGeometry::Cell<1> {
+    //bool visited = false;
+    uint32_t index = 0;
+    uint8_t sl = 0;
+    Tetra* origin = nullptr;
+    const Spin* root = nullptr;
+};
+
+struct Plaq : public CellGeometry::Cell<2> {
+//    bool visited = false;
+    const Plaq* root = nullptr;
+};
+
+struct Vol : public CellGeometry::Cell<3> {
+ //   bool visited = false;
+    const Vol* root = nullptr;
+};
+
+typedef CellGeometry::PeriodicVolLattice<Tetra, Spin, Plaq, Vol> Lattice;
+
+
+// Sets the 'sl' of every point and link. The searches and excisions below
+// take the links of a point, and the points of a link, in increasing sl,
+// which is the order the implicit engine's incidence tables list them in
+// (diamond_tables.hpp), so that both engines excise the same paths. Left
+// unset, as in dmnd_dilute, every sl is 0 and latticelab's order is kept,
+// so that existing run keys keep their results.
+inline void index_sublattices(Lattice& lat, const diamond_geometry& geo){
+    for (const auto& [_, p] : lat.points){
+        p->sl = geo.cell_at_position(0, p->position) % diamond_geometry::n_sl(0);
+    }
+    for (const auto& [_, l] : lat.links){
+        l->sl = geo.cell_at_position(1, l->position) % diamond_geometry::n_sl(1);
+    }
+}
+
+// The (at most four) cells of a chain, in increasing sl, into 'out';
+// returns how many there are
+template<typename T, typename C>
+inline unsigned by_sublattice(const C& chain, T* (&out)[4]){
+    unsigned n = 0;
+    for (const auto& [c, _] : chain){
+        T* x = static_cast<T*>(c);
+        unsigned k = n++;
+        for (; k > 0 && out[k-1]->sl > x->sl; k--) out[k] = out[k-1];
+        out[k] = x;
+    }
+    return n;
+}
+
+
+// Breadth-first search tree node; paths are recovered by walking 'parent'
+// Links are recorded by index as well, which stays valid after the
+// link itself has been erased.
+struct search_node {
+    Tetra* point;
+    Spin* link;       // link used to reach 'point'
+    uint32_t link_index;
+    unsigned parent;  // index into the tree
+    unsigned depth;
+};
+
+// A path, as the tree nodes of its links in order
+typedef std::pmr::vector<const search_node*> search_path;
+
+
+// Erases the links of path, appending any tetra this leaves newly
+// under-coordinated to new_defects
+inline void excise_path(Lattice& lat, const search_path& path, cell_set<Spin>& deleted_links, std::vector<ipos_t>& deleted_link_locs,
+        std::vector<Tetra*>& new_defects){
+    for (auto node : path){
+        if (!deleted_links.contains_index(node->link_index)){
+            auto s = node->link;
+            Tetra* ends[4];
+            const unsigned n_ends = by_sublattice(s->boundary, ends);
+            for (unsigned k=0; k<n_ends; k++){
+                if (ends[k]->coboundary.size() == 4) new_defects.push_back(ends[k]);
+            }
+            deleted_link_locs.push_back(s->position);
+            deleted_links.insert(s);
+            lat.erase_link(s);
+            WORK_COUNT(work.erase_link_calls++);
+        }
+    }
+}
+
+inline void find_defect_tree(
+        Tetra* origin, unsigned max_len, std::pmr::vector<search_node>& tree){
+    /** 
+     * Breadth-first search of all paths of up to max_len links from origin,
+     * visiting each link at most once. Links are marked with origin as they
+     * are reached, see clear_defect_tree.
+     * @param origin: the starting point
+     * @param max_len: the longest lattice-sep of interest, measured as the
+     * number of Tetras that are part of the path EXCLUDING start 
+     * (len=1 correspnds to nearest-neighbour pyrochlore sites)
+     * @param tree: overwritten with the search tree, rooted at tree[0]
+     */
+
+    tree.clear();
+    tree.push_back({origin, nullptr, 0, 0, 0});
+    WORK_COUNT(work.bfs_pushed++);
+
+    for (size_t head=0; head<tree.size(); head++){
+        WORK_COUNT(work.bfs_popped++,
+                work_counters::peak(work.bfs_peak_queue, tree.size() - head));
+        const auto curr = tree[head];
+        if (curr.depth == max_len) continue;
+
+#ifdef DEBUG
+        std::cout<<curr.point->position<<"\t| "<< curr.depth <<"\n";
+#endif
+        Spin* links[4];
+        const unsigned n_links = by_sublattice(curr.point->coboundary, links);
+        for (unsigned k=0; k<n_links; k++){
+            Spin* ln = links[k];
+            if (ln->origin == origin) continue;
+            ln->origin = origin;
+            for (auto [p2, n] : ln->boundary){
+                if (p2 != curr.point){ 
+                    tree.push_back({static_cast<Tetra*>(p2), ln, ln->index, unsigned(head), curr.depth+1});
+                    WORK_COUNT(work.bfs_pushed++);
+                }
+            }
+        }
+    }
+}
+
+// Clears the marks find_defect_tree left on the links of 'tree', so that
+// its origin can be searched again; the links must not have been erased
+inline void clear_defect_tree(const std::pmr::vector<search_node>& tree){
+    for (size_t i=1; i<tree.size(); i++) tree[i].link->origin = nullptr;
+}
+
+inline std::pmr::vector<search_path> find_defect_links(
+        const std::pmr::vector<search_node>& tree, unsigned len){
+    /**
+     * Extracts from a search tree the paths of exactly len links that end
+     * on a defect tetra.
+     */
+    std::pmr::vector<search_path> res;
+    for (size_t i=0; i<tree.size(); i++){
+        if (tree[i].depth != len || tree[i].point->coboundary.size() >= 4) continue;
+
+        search_path path(len);
+        auto idx = i;
+        for (unsigned k=len; k-- > 0;){
+            path[k] = &tree[idx];
+            idx = tree[idx].parent;
+        }
+        res.push_back(std::move(path));
+    }
+    return res;
+}
+
+
+
+
+/**
+ * Finds the paths of every length in lens (sorted) from each of 'defects'
+ * and excises them, shortest first, counting them in n_dimers. Each length
+ * searches each defect in turn, on the lattice as the excisions before it
+ * left it, so only one search tree is held at a time. The number of paths
+ * grows geometrically with length, so the shorter lengths add only a
+ * fraction to the cost of the longest.
+ * @param n_visited: if given, incremented by the points the searches visit
+ * @return the tetras left newly under-coordinated by the excisions
+ */
+inline std::vector<Tetra*> excise_defect_paths(
+        Lattice& lat,
+        const std::vector<Tetra*>& defects,
+        const std::vector<int>& lens,
+        cell_set<Spin>& deleted_links,
+        std::vector<ipos_t>& deleted_link_locs,
+        std::map<size_t, size_t>& n_dimers,
+        bool verbose=true,
+        size_t* n_visited=nullptr
+        ){
+    std::vector<Tetra*> new_defects;
+    unsigned total_n = defects.size();
+    std::pmr::vector<search_node> tree;
+
+    for (auto len : lens){
+        if (verbose) printf("[search] excising %d neighbours\n", len);
+
+        n_dimers[len] = 0;
+        for (unsigned i=0; i<total_n; i++){
+            find_defect_tree(defects[i], len, tree);
+            if (n_visited) *n_visited += tree.size();
+            auto links = find_defect_links(tree, len);
+            clear_defect_tree(tree);
+
+            n_dimers[len] += links.size();
+            WORK_COUNT(work.paths_found[len] += links.size());
+            for (const auto& path : links){
+                WORK_COUNT(if (std::any_of(path.begin(), path.end(), [&](const search_node* n){
+                            return !deleted_links.contains_index(n->link_index); }))
+                        work.paths_excised[len]++);
+                excise_path(lat, path, deleted_links, deleted_link_locs, new_defects);
+            }
+
+            if (verbose){
+                printf("%5d / %5d (%02d%%)\r", i, total_n, i * 100 / total_n);
+                fflush(stdout); 
+            }
+        }
+        if (verbose) printf("\n");
+    }
+    return new_defects;
+}
+
+
+// Deletes the given spins from the lattice, collecting the tetras left
+// under-coordinated in defect_pts. Every spin came from lat.links and
+// appears once, so each is still present when it is erased.
+inline void del_spins_get_dtetras(Lattice& lat, const cell_set<Spin>& spins_to_delete, cell_set<Tetra>& defect_pts){
+    for (auto l : spins_to_delete){
+        for (const auto& [p, _] : l->boundary){
+            defect_pts.insert(static_cast<Tetra*>(p));
+        }
+        lat.erase_link(l);
+        WORK_COUNT(work.erase_link_calls++);
+    }
+}
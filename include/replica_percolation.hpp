@@ -0,0 +1,186 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+#include "counter_rng.hpp"
+#include "implicit_diamond.hpp"
+
+/**
+ * Percolation of 64 independent random dilutions at once.
+ *
+ * Bit r of a cell's mask says whether it is alive in replica r, which is
+ * diluted exactly as the implicit/streaming engines dilute with seed
+ * (seed + r). Cluster finding walks the shared geometry once, carrying the
+ * set of replicas a cell was reached in as a word-wide mask, so neighbour
+ * lookups are paid once for up to 64 realisations.
+ */
+
+constexpr unsigned n_replicas = 64;
+
+struct replica_dilution {
+    const diamond_geometry& geo;
+    uint64_t seed;
+    double p;
+    // per-cell replica masks of links (1), plaqs (2) and vols (3), the
+    // latter two only up to dimension top_dim
+    std::vector<uint64_t> alive[4];
+
+    replica_dilution(const diamond_geometry& geo, uint64_t seed, double p, int top_dim=3)
+        : geo(geo), seed(seed), p(p) {
+        alive[1].resize(geo.size(1));
+        for (uint64_t l=0; l<geo.size(1); l++){
+            uint64_t m = 0;
+            for (unsigned r=0; r<n_replicas; r++){
+                m |= uint64_t(!counter_bernoulli(seed + r, l, p)) << r;
+            }
+            alive[1][l] = m;
+        }
+
+        // a plaq (vol) lives wherever all of its boundary does
+        if (top_dim < 2) return;
+        alive[2].resize(geo.size(2));
+        for (uint64_t q=0; q<geo.size(2); q++){
+            uint64_t m = ~uint64_t(0);
+            for (const auto& o : diamond::plaq_boundary[q % 4]){
+                m &= alive[1][geo.cell_at(q, 2, o, 1)];
+            }
+            alive[2][q] = m;
+        }
+
+        if (top_dim < 3) return;
+        alive[3].resize(geo.size(3));
+        for (uint64_t v=0; v<geo.size(3); v++){
+            uint64_t m = ~uint64_t(0);
+            for (const auto& o : diamond::vol_boundary[v % 2]){
+                m &= alive[2][geo.cell_at(v, 3, o, 2)];
+            }
+            alive[3][v] = m;
+        }
+    }
+};
+
+
+// Per-replica clusters of one cell dimension
+struct replica_clusters {
+    std::array<std::vector<cluster_summary>, n_replicas> clusters;
+    std::array<uint64_t, n_replicas> n_alive{};
+};
+
+
+// Calls f(r) for every set bit r of mask
+template<typename F>
+inline void for_each_bit(uint64_t mask, F&& f){
+    while (mask){
+        f(std::countr_zero(mask));
+        mask &= mask - 1;
+    }
+}
+
+
+/**
+ * Bit-parallel counterpart of find_connected<dim>(implicit_diamond&).
+ * Cells are taken in id order; the replicas in which a cell is alive but
+ * not yet reached start a cluster there, which is then grown by BFS in all
+ * of them at once. The root and wrapping test are those of find_connected,
+ * so replica r gives the same clusters as the implicit engine with seed+r.
+ * Replicas reaching a cell that is still queued at the same unwrapped
+ * position join its pending entry rather than queueing it again, so it is
+ * expanded once for all of them. Arriving at another position (their routes
+ * differ by a supercell translation) they queue an entry of their own, so
+ * each replica's positions are unwrapped along its own search.
+ */
+template<int dim>
+inline replica_clusters find_connected_replicas(const replica_dilution& dil){
+    static_assert(dim >= 1 && dim <= 3, "Only links, plaqs and vols are clustered");
+    constexpr unsigned nsl = diamond_geometry::n_sl(dim);
+
+    const auto& geo = dil.geo;
+    const auto& alive = dil.alive[dim];
+
+    std::vector<diamond::cell_offset> nbrs[nsl];
+    std::vector<ipos_t> nbr_disp[nsl];
+    for (unsigned sl=0; sl<nsl; sl++){
+        nbrs[sl] = face_neighbour_offsets(dim, sl);
+        for (const auto& o : nbrs[sl]){
+            nbr_disp[sl].push_back(diamond_geometry::displacement(dim, sl, o));
+        }
+    }
+
+    // BFS queue entry: a cell, its unwrapped position and the replicas
+    // that reached it there
+    struct entry {
+        uint32_t cell;
+        ipos_t x;
+        uint64_t mask;
+    };
+    constexpr uint64_t none = UINT64_MAX;
+
+    replica_clusters res;
+    const uint64_t N = geo.size(dim);
+    std::vector<uint64_t> visited(N, 0);
+    // the latest entry of a cell still in the queue
+    std::vector<uint64_t> pending(N, none);
+    std::vector<entry> queue;
+    std::array<cluster_summary, n_replicas> current;
+
+    for (uint64_t root_cell=0; root_cell<N; root_cell++){
+        for_each_bit(alive[root_cell], [&](int r){ res.n_alive[r]++; });
+        const uint64_t start = alive[root_cell] & ~visited[root_cell];
+        if (!start) continue;
+
+        for_each_bit(start, [&](int r){ current[r] = {}; });
+        // entries reached in every replica of the cluster, kept once
+        cluster_summary shared;
+        uint64_t wraps = 0;
+
+        visited[root_cell] |= start;
+        queue.assign(1, {uint32_t(root_cell), geo.position(dim, root_cell), start});
+        pending[root_cell] = 0;
+        for (size_t head=0; head<queue.size(); head++){
+            const auto curr = queue[head];
+            const uint64_t mask = curr.mask;
+            if (pending[curr.cell] == head) pending[curr.cell] = none;
+
+            if (mask == start){
+                shared.size++;
+                shared.moments.add(curr.x);
+            } else {
+                for_each_bit(mask, [&](int r){
+                    current[r].size++;
+                    current[r].moments.add(curr.x);
+                });
+            }
+            if ((mask & ~wraps) && geo.d2(dim, curr.cell, root_cell) > geo.Lmin2/4){
+                wraps |= mask;
+            }
+
+            const unsigned sl = curr.cell % nsl;
+            for (size_t j=0; j<nbrs[sl].size(); j++){
+                auto next = geo.cell_at(curr.cell, dim, nbrs[sl][j], dim);
+                uint64_t m = mask & alive[next] & ~visited[next];
+                if (m){
+                    visited[next] |= m;
+                    const auto x = curr.x + nbr_disp[sl][j];
+                    if (pending[next] != none && queue[pending[next]].x == x){
+                        queue[pending[next]].mask |= m;
+                    } else {
+                        pending[next] = queue.size();
+                        queue.push_back({next, x, m});
+                    }
+                }
+            }
+        }
+
+        for_each_bit(start, [&](int r){
+            current[r].size += shared.size;
+            current[r].moments.merge(shared.moments, shared.size, ipos_t{0, 0, 0});
+            current[r].wraps = (wraps >> r) & 1;
+            current[r].spans = spans_supercell(current[r].moments, geo.Lmin2);
+            res.clusters[r].push_back(current[r]);
+        });
+    }
+
+    return res;
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fnv1a.hpp"
+
+/**
+ * Where the outputs of a run live.
+ *
+ * A run is named by its parameters as "k1=v1;k2=v2;flag;" (see
+ * format_bits.hpp). Its outputs are stored under a short key, a hash of
+ * those parameters, as <outdir>/<first two digits of key>/<key><suffix>,
+ * so no directory holds more than a few thousand files. Every record
+ * carries its full parameters. Each completed run is also appended as one
+ * line to <outdir>/manifest.jsonl, which gives its key, name, parameters
+ * and files, so ingestion reads the manifest instead of listing directories.
+ */
+
+namespace run_key {
+
+inline const char* manifest_name = "manifest.jsonl";
+
+// The parameters of a run name, as strings; flags map to true
+inline nlohmann::json params_of(const std::string& name){
+    nlohmann::json res = nlohmann::json::object();
+    size_t start = 0;
+    while (start < name.size()){
+        size_t end = name.find(';', start);
+        if (end == std::string::npos) end = name.size();
+        const auto field = name.substr(start, end - start);
+        if (!field.empty()){
+            const size_t eq = field.find('=');
+            if (eq == std::string::npos){
+                res[field] = true;
+            } else {
+                res[field.substr(0, eq)] = field.substr(eq + 1);
+            }
+        }
+        start = end + 1;
+    }
+    return res;
+}
+
+
+// 16 hex digits, independent of the order parameters were named in
+inline std::string key_of(const std::string& name){
+    const auto canonical = params_of(name).dump();
+    char buf[32];
+    snprintf(buf, 32, "%016llx",
+            (unsigned long long)fnv1a(canonical.data(), canonical.size()));
+    return buf;
+}
+
+
+// Path of the output 'suffix' (e.g. ".stats.json") of the run 'name',
+// creating its shard directory
+inline std::filesystem::path output_path(const std::filesystem::path& outdir,
+        const std::string& name, const std::string& suffix){
+    const auto key = key_of(name);
+    const auto dir = outdir/key.substr(0, 2);
+    std::filesystem::create_directories(dir);
+    return dir/(key + suffix);
+}
+
+
+/**
+ * Appends the run to the manifest of 'outdir'. The line is written with a
+ * single append under an exclusive lock, so concurrent runs sharing an
+ * outdir never interleave. merge_to_sql.py --cleanup renames the manifest
+ * away under the same lock, so once locked the file is checked to still be
+ * the manifest, and reopened if not.
+ */
+inline void record(const std::filesystem::path& outdir, const std::string& name,
+        const std::vector<std::filesystem::path>& files){
+    nlohmann::json rec = {};
+    rec["key"] = key_of(name);
+    rec["name"] = name;
+    rec["params"] = params_of(name);
+    rec["files"] = nlohmann::json::array();
+    for (const auto& f : files){
+        rec["files"].push_back(f.lexically_relative(outdir).string());
+    }
+    const auto line = rec.dump() + "\n";
+
+    const auto path = outdir/manifest_name;
+    int fd;
+    while (true){
+        fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+        if (fd < 0) throw std::runtime_error("Cannot open manifest "+path.string());
+        flock(fd, LOCK_EX);
+        struct stat opened, current;
+        if (fstat(fd, &opened) == 0 && ::stat(path.c_str(), &current) == 0
+                && opened.st_dev == current.st_dev && opened.st_ino == current.st_ino){
+            break;
+        }
+        ::close(fd);
+    }
+    size_t done = 0;
+    while (done < line.size()){
+        auto n = ::write(fd, line.data() + done, line.size() - done);
+        if (n <= 0) break;
+        done += n;
+    }
+    flock(fd, LOCK_UN);
+    ::close(fd);
+    if (done < line.size()) throw std::runtime_error("Failed appending to manifest "+path.string());
+}
+
+} // end namespace run_key
@@ -0,0 +1,260 @@
+#pragma once
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "counter_rng.hpp"
+#include "geom_traverser.hpp"
+#include "implicit_diamond.hpp"
+
+/**
+ * Out-of-core percolation on supercells too large to hold in memory.
+ *
+ * Liveness is never stored: links are deleted with counter-based randomness
+ * keyed by their implicit id, and plaqs/vols are alive iff all of their
+ * boundary is. Cells are labelled Hoshen-Kopelman style one slab (fixed
+ * third HNF coordinate, i.e. a contiguous range of implicit ids) at a time,
+ * holding cell labels for the current and previous slab only, plus the first
+ * slab for closing the periodic boundary at the end.
+ *
+ * The union-find over provisional labels is not streamed: every label lives
+ * until the end of the pass, and there are up to 0.2 of them per link of the
+ * supercell at any dilution (far fewer plaqs and vols), so the footprint grows
+ * with the supercell.
+ */
+
+
+// Random dilution of an implicit lattice, evaluated on demand.
+// Agrees exactly with the implicit engine's 'random' strategy.
+struct streamed_dilution {
+    const diamond_geometry& geo;
+    uint64_t seed;
+    double p;
+
+    inline bool link_alive(uint64_t l) const {
+        return !counter_bernoulli(seed, l, p);
+    }
+
+    inline bool plaq_alive(uint64_t q) const {
+        for (const auto& o : diamond::plaq_boundary[q % 4]){
+            if (!link_alive(geo.cell_at(q, 2, o, 1))) return false;
+        }
+        return true;
+    }
+
+    inline bool vol_alive(uint64_t v) const {
+        for (const auto& o : diamond::vol_boundary[v % 2]){
+            if (!plaq_alive(geo.cell_at(v, 3, o, 2))) return false;
+        }
+        return true;
+    }
+
+    template<int dim>
+    inline bool alive(uint64_t id) const {
+        if constexpr (dim == 1) return link_alive(id);
+        else if constexpr (dim == 2) return plaq_alive(id);
+        else return vol_alive(id);
+    }
+};
+
+
+/**
+ * Streaming counterpart of find_connected<dim>(implicit_diamond&), giving
+ * identical clusters in identical order.
+ *
+ * Pass 1 assigns provisional labels and merges them with a union-find in
+ * which the older label always wins, so each cluster's root label belongs to
+ * its lowest id, which is where find_connected starts its DFS.
+ * Every label also carries its own frame of unwrapped positions, stored as
+ * a shift relative to its parent's, and the position moments of its cells;
+ * merging two labels shifts the loser's moments into the winner's frame.
+ * Pass 2 regenerates the slabs, now knowing every cell's final cluster and
+ * its root, and applies the same half-box wrapping test as find_connected.
+ *
+ * Moments of non-wrapping clusters agree with find_connected; those of
+ * wrapping clusters depend on the path they were unwrapped along.
+ *
+ * Memory: three slabs of labels and positions (28 bytes per cell each), plus
+ * 120 bytes per provisional label in pass 1 and the returned summaries
+ * (~100 bytes per cluster).
+ * @param n_alive: set to the number of live cells
+ */
+template<int dim>
+inline std::vector<cluster_summary> find_connected_streaming(
+        const streamed_dilution& dil, uint64_t& n_alive){
+    static_assert(dim >= 1 && dim <= 3, "Only links, plaqs and vols are clustered");
+    constexpr unsigned nsl = diamond_geometry::n_sl(dim);
+    constexpr uint32_t NONE = UINT32_MAX;
+
+    const auto& geo = dil.geo;
+    const uint64_t S = geo.sc.H[0][0] * geo.sc.H[1][1] * nsl;
+    const uint64_t n_slabs = geo.sc.H[2][2];
+    if (n_slabs < 3){
+        // otherwise the previous and next slab coincide
+        throw std::invalid_argument("Slab streaming needs at least three slabs along Z3");
+    }
+
+    std::vector<diamond::cell_offset> nbrs[nsl];
+    std::vector<ipos_t> nbr_disp[nsl];
+    for (unsigned sl=0; sl<nsl; sl++){
+        nbrs[sl] = face_neighbour_offsets(dim, sl);
+        for (const auto& o : nbrs[sl]){
+            nbr_disp[sl].push_back(diamond_geometry::displacement(dim, sl, o));
+        }
+    }
+
+    std::vector<uint32_t> first(S), prev(S), cur(S);
+    // unwrapped position of each labelled cell, in its label's frame
+    std::vector<ipos_t> first_x, prev_x(S), cur_x(S);
+
+    // Label of neighbour 'nid' of cell 'id' in slab k, if it has one yet
+    auto processed_label = [&](uint64_t k, uint64_t id, uint64_t nid) -> uint32_t {
+        uint64_t nk = nid / S;
+        uint64_t ni = nid % S;
+        if (nk == k) return nid < id ? cur[ni] : NONE;
+        if (k > 0 && nk == k-1) return prev[ni];
+        if (k == n_slabs-1 && nk == 0) return first[ni];
+        return NONE;
+    };
+
+    // Position stored alongside processed_label(k, id, nid)
+    auto processed_x = [&](uint64_t k, uint64_t nid) -> const ipos_t& {
+        uint64_t nk = nid / S;
+        uint64_t ni = nid % S;
+        if (nk == k) return cur_x[ni];
+        if (nk + 1 == k) return prev_x[ni];
+        return first_x[ni];
+    };
+
+    auto sweep = [&](auto&& label_cell){
+        for (uint64_t k=0; k<n_slabs; k++){
+            for (uint64_t i=0; i<S; i++){
+                uint64_t id = k*S + i;
+                cur[i] = dil.template alive<dim>(id) ? label_cell(k, id, cur_x[i]) : NONE;
+            }
+            if (k == 0) {
+                first = cur;
+                first_x = cur_x;
+            }
+            std::swap(prev, cur);
+            std::swap(prev_x, cur_x);
+        }
+    };
+
+    // Pass 1: Hoshen-Kopelman
+    std::vector<uint32_t> parent;
+    std::vector<ipos_t> shift;          // frame of each label, in its parent's
+    std::vector<uint32_t> root_cell;    // the cell that created each label
+    std::vector<uint64_t> label_size;   // cells merged into each root
+    std::vector<cluster_moments> moments;
+
+    // Root of x, and the shift from x's frame to the root's
+    auto find = [&](uint32_t x, ipos_t& s){
+        s = ipos_t{0, 0, 0};
+        uint32_t r = x;
+        while (parent[r] != r){
+            s = s + shift[r];
+            r = parent[r];
+        }
+        // compress, with each label's shift now taken straight to the root
+        ipos_t rest = s;
+        while (parent[x] != r && x != r){
+            auto next = parent[x];
+            auto next_shift = rest - shift[x];
+            parent[x] = r;
+            shift[x] = rest;
+            rest = next_shift;
+            x = next;
+        }
+        return r;
+    };
+
+    n_alive = 0;
+    sweep([&](uint64_t k, uint64_t id, ipos_t& x){
+        n_alive++;
+        const unsigned sl = id % nsl;
+        uint32_t lab = NONE;
+        for (size_t j=0; j<nbrs[sl].size(); j++){
+            auto nid = geo.cell_at(id, dim, nbrs[sl][j], dim);
+            auto l = processed_label(k, id, nid);
+            if (l == NONE) continue;
+            ipos_t s;
+            l = find(l, s);
+            // this cell, in the frame of l
+            ipos_t xl = processed_x(k, nid) + s - nbr_disp[sl][j];
+            if (lab == NONE) {
+                lab = l;
+                x = xl;
+            } else if (l != lab) {
+                // o takes positions in l's frame to lab's
+                ipos_t o = x - xl;
+                if (l < lab) {
+                    std::swap(l, lab);
+                    o = ipos_t{0, 0, 0} - o;
+                    x = xl;
+                }
+                parent[l] = lab;
+                shift[l] = o;
+                moments[lab].merge(moments[l], label_size[l], o);
+                label_size[lab] += label_size[l];
+            }
+        }
+        if (lab == NONE){
+            lab = parent.size();
+            parent.push_back(lab);
+            shift.push_back(ipos_t{0, 0, 0});
+            root_cell.push_back(id);
+            label_size.push_back(0);
+            moments.push_back({});
+            x = geo.position(dim, id);
+        }
+        moments[lab].add(x);
+        label_size[lab]++;
+        return lab;
+    });
+    shift = {};
+    label_size = {};
+
+    // Flatten, then renumber the roots 0..n_comp-1 in place. Every label
+    // points at an older one, so ascending order sees parents first.
+    uint32_t n_comp = 0;
+    for (uint32_t l=0; l<parent.size(); l++){
+        if (parent[l] == l){
+            root_cell[n_comp] = root_cell[l];
+            moments[n_comp] = moments[l];
+            parent[l] = n_comp++;
+        } else {
+            parent[l] = parent[parent[l]];
+        }
+    }
+    root_cell.resize(n_comp);
+    moments.resize(n_comp);
+
+    // Pass 2: labels are now final cluster indices. Any labelled neighbour
+    // is in the same cluster, and a cell without one created a label in
+    // pass 1 as well, in the same order.
+    std::vector<cluster_summary> component_list(n_comp);
+    for (uint32_t c=0; c<n_comp; c++){
+        component_list[c].moments = moments[c];
+        component_list[c].spans = spans_supercell(moments[c], geo.Lmin2);
+    }
+    moments = {};
+    uint32_t n_prov = 0;
+    sweep([&](uint64_t k, uint64_t id, ipos_t&){
+        uint32_t c = NONE;
+        for (const auto& o : nbrs[id % nsl]){
+            c = processed_label(k, id, geo.cell_at(id, dim, o, dim));
+            if (c != NONE) break;
+        }
+        if (c == NONE) c = parent[n_prov++];
+
+        auto& cell_union = component_list[c];
+        cell_union.size++;
+        if (!cell_union.wraps && geo.d2(dim, id, root_cell[c]) > geo.Lmin2/4){
+            cell_union.wraps = true;
+        }
+        return c;
+    });
+
+    return component_list;
+}
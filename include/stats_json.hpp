@@ -0,0 +1,286 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include <cell_geometry.hpp>
+
+#include "diamond_tables.hpp"
+#include "geom_traverser.hpp"
+#include "implicit_diamond.hpp"
+#include "run_key.hpp"
+
+/**
+ * The contents of a .stats.json, from the cluster lists of any engine.
+ */
+
+
+/**
+ * The cluster statistics a run computes (dmnd_dilute --stats): for each of
+ * links, plaqs and vols, all of them, only whether some cluster wraps, or
+ * none. Parsed from a comma-separated list of "links", "plaqs", "vols",
+ * and "links_wrap", "plaqs_wrap", "vols_wrap" for the flag alone.
+ */
+struct stats_selection {
+    enum level { none, wrap_only, full };
+    level dims[4] = {none, full, full, full};
+
+    static const char* dim_name(int dim){
+        static const char* names[4] = {"points", "links", "plaqs", "vols"};
+        return names[dim];
+    }
+
+    static stats_selection parse(const std::string& spec){
+        stats_selection res;
+        for (int dim=1; dim<4; dim++) res.dims[dim] = none;
+        std::stringstream ss(spec);
+        std::string item;
+        bool any = false;
+        while (std::getline(ss, item, ',')){
+            bool known = false;
+            for (int dim=1; dim<4; dim++){
+                if (item == dim_name(dim)){
+                    res.dims[dim] = full;
+                } else if (item == std::string(dim_name(dim)) + "_wrap"){
+                    res.dims[dim] = std::max(res.dims[dim], wrap_only);
+                } else continue;
+                known = true;
+            }
+            if (!known) throw std::invalid_argument("Unknown statistic '"+item+"'");
+            any = true;
+        }
+        if (!any) throw std::invalid_argument("No statistics selected");
+        return res;
+    }
+
+    inline bool computes(int dim) const { return dims[dim] != none; }
+    inline bool is_full(int dim) const { return dims[dim] == full; }
+    // plaqs or vols are needed at all
+    inline bool faces() const { return computes(2) || computes(3); }
+
+    inline bool everything() const {
+        return is_full(1) && is_full(2) && is_full(3);
+    }
+
+    // As parsed, e.g. "links,vols_wrap"
+    std::string str() const {
+        std::string res;
+        for (int dim=1; dim<4; dim++){
+            if (!computes(dim)) continue;
+            if (!res.empty()) res += ",";
+            res += dim_name(dim);
+            if (!is_full(dim)) res += "_wrap";
+        }
+        return res;
+    }
+
+    // Drops the counts of the dimensions not computed, which the implicit
+    // engine leaves stale (see dilute_and_excise)
+    void prune_counts(nlohmann::json& counts) const {
+        for (int dim=1; dim<4; dim++){
+            if (!computes(dim)) counts.erase(dim_name(dim));
+        }
+    }
+};
+
+template <typename P, typename L, typename Pl, typename V>
+inline nlohmann::json latstats_to_json(const CellGeometry::PeriodicVolLattice<P, L, Pl, V>& lat){
+    nlohmann::json counts = {};
+    counts["points"] = lat.points.size();
+    counts["links"] = lat.links.size();
+    counts["plaqs"] = lat.plaqs.size();
+    counts["vols"] = lat.vols.size();
+
+    return counts;
+}
+
+inline nlohmann::json latstats_to_json(const implicit_diamond& lat){
+    nlohmann::json counts = {};
+    counts["points"] = lat.count_alive(0);
+    counts["links"] = lat.count_alive(1);
+    counts["plaqs"] = lat.count_alive(2);
+    counts["vols"] = lat.count_alive(3);
+
+    return counts;
+}
+
+// returns a set of sizes of the conn_components, sorted low to high
+template <typename T>
+inline std::vector<size_t> get_sorted_sizes(const std::vector<conn_components<T>>& parts ){
+    std::vector<size_t> size_set;
+    for (const auto& p : parts){
+        auto size = p.elems.size();
+        auto it = std::lower_bound(size_set.begin(), size_set.end(), size);
+        size_set.insert(it, size);
+    }
+    return size_set;
+}
+
+template <typename C>
+inline std::map<size_t, size_t>
+size_histogram(const std::vector<C>& parts){
+    std::map<size_t, size_t> hist;
+    for (const auto&p : parts){
+        auto size = cluster_size(p);
+        if (hist.find(size) == hist.end()) {
+          hist[size] = 1;
+        } else {
+          hist[size]++;
+        }
+    }
+    return hist;
+}
+
+
+template <typename T>
+inline std::pair<bool, std::vector<ipos_t>> test_wraps(const std::vector<conn_components<T>>& parts ){
+    std::vector<ipos_t> wrapping_cluster;
+    bool wraps = false;
+    for (const auto& p : parts){
+        if (p.wraps) { 
+            wraps = true;
+            for (auto x : p.elems) {
+                wrapping_cluster.push_back(x->position);
+            }
+            break;
+        }
+    }
+    return std::make_pair(wraps, wrapping_cluster);
+}
+
+// Summaries carry no positions, so only the flag is available
+inline std::pair<bool, std::vector<ipos_t>> test_wraps(const std::vector<cluster_summary>& parts ){
+    bool wraps = std::any_of(parts.begin(), parts.end(),
+            [](const cluster_summary& p){ return p.wraps; });
+    return std::make_pair(wraps, std::vector<ipos_t>());
+}
+
+
+// Writes the cluster observables of summarise_clusters as <prefix>_<name>
+template <typename C>
+inline void cluster_observables(nlohmann::json& percolstats, const std::string& prefix,
+        const std::vector<C>& parts, uint64_t n_total){
+    auto stats = summarise_clusters(parts, n_total);
+    percolstats[prefix+"_largest"] = stats.largest;
+    percolstats[prefix+"_second_largest"] = stats.second_largest;
+    percolstats[prefix+"_P_inf"] = stats.P_inf;
+    percolstats[prefix+"_mean_size"] = stats.mean_size;
+    if (std::isnan(stats.largest_Rg)) percolstats[prefix+"_largest_Rg"] = nullptr;
+    else percolstats[prefix+"_largest_Rg"] = stats.largest_Rg;
+}
+
+
+template <typename CL, typename CP, typename CV>
+inline nlohmann::json percolstats_to_json(
+        uint64_t n_prim_cells,
+        const std::vector<CL>& connected_links,
+        const std::vector<CP>& connected_plaqs,
+        const std::vector<CV>& connected_vols,
+        bool verbose=true,
+        const stats_selection& sel=stats_selection()
+        ) {
+
+    nlohmann::json percolstats = {};
+
+    if (sel.is_full(1)){
+        percolstats["n_link_parts"] = connected_links.size();
+        percolstats["link_cluster_dist"] = size_histogram(connected_links);
+        cluster_observables(percolstats, "link", connected_links, n_prim_cells*diamond::n_sl[1]);
+    }
+    if (sel.computes(1)){
+        auto tmp_link = test_wraps(connected_links);
+        percolstats["links_wrap"] = tmp_link.first;
+        // percolstats["link_wrapping_cluster"] = tmp_link.second;
+    }
+
+    if (sel.is_full(2)){
+        percolstats["n_plaq_parts"] = connected_plaqs.size();
+        percolstats["plaq_cluster_dist"] = size_histogram(connected_plaqs);
+        cluster_observables(percolstats, "plaq", connected_plaqs, n_prim_cells*diamond::n_sl[2]);
+    }
+    if (sel.computes(2)){
+        percolstats["plaqs_wrap"] = test_wraps(connected_plaqs).first;
+    }
+
+    if (sel.is_full(3)){
+        percolstats["n_vol_parts"] = connected_vols.size();
+        percolstats["vol_cluster_dist"] = size_histogram(connected_vols);
+        cluster_observables(percolstats, "vol", connected_vols, n_prim_cells*diamond::n_sl[3]);
+    }
+    if (sel.computes(3)){
+        percolstats["vols_wrap"] = test_wraps(connected_vols).first;
+    }
+
+    if (verbose){
+        if (sel.computes(1)) std::cout<< "Links wrap: " << percolstats["links_wrap"] <<"\n";
+        if (sel.computes(2)) std::cout<< "Plaqs wrap: " << percolstats["plaqs_wrap"] <<"\n";
+        if (sel.computes(3)) std::cout<< "Vols wrap: " << percolstats["vols_wrap"] <<"\n";
+    }
+
+    return percolstats;
+}
+
+
+
+/**
+ * A whole statfile: the run's key and parameters, cell counts, cluster
+ * statistics and the path counts n_dimers (one map per generation of the
+ * cascade, or none; the run is a cascade if its name says so). Unless 'sel' is everything, it also lists the
+ * statistics it holds as "stats".
+ */
+template <typename CL, typename CP, typename CV>
+inline nlohmann::json stats_to_json(
+        const std::string& name,
+        const nlohmann::json& counts,
+        uint64_t n_prim_cells,
+        const std::vector<CL>& connected_links,
+        const std::vector<CP>& connected_plaqs,
+        const std::vector<CV>& connected_vols,
+        const std::vector<std::map<size_t, size_t>>& n_dimers,
+        bool verbose=true,
+        const stats_selection& sel=stats_selection()
+        ){
+    nlohmann::json j = {};
+
+    j["__version__"] = 3;
+    j["key"] = run_key::key_of(name);
+    j["params"] = run_key::params_of(name);
+    if (!sel.everything()) j["stats"] = sel.str();
+    j["counts"] = counts;
+    sel.prune_counts(j["counts"]);
+    j["percolation"] = percolstats_to_json(n_prim_cells,
+            connected_links, connected_plaqs, connected_vols, verbose, sel);
+
+    // Paths found from the original defects; with --cascade, also those
+    // of every generation, the first included, and their totals, whatever
+    // the number of generations, so that cascade statfiles share one shape
+    j["n_dimers"] = {};
+    if (!n_dimers.empty()){
+        for (auto& [n, c] : n_dimers.front()){
+            j["n_dimers"][std::to_string(n)] = c;
+            if (verbose) std::cout << n <<"-dimers: " << c <<"\n";
+        }
+    }
+    if (j["params"].value("cascade", false)){
+        j["n_dimers"]["by_generation"] = nlohmann::json::array();
+        std::map<size_t, size_t> total;
+        for (const auto& gen : n_dimers){
+            nlohmann::json counts = {};
+            for (auto& [n, c] : gen){
+                counts[std::to_string(n)] = c;
+                total[n] += c;
+            }
+            j["n_dimers"]["by_generation"].push_back(counts);
+        }
+        j["n_dimers"]["total"] = nlohmann::json::object();
+        for (auto& [n, c] : total) j["n_dimers"]["total"][std::to_string(n)] = c;
+    }
+    return j;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <nlohmann/json.hpp>
+
+/**
+ * Counts of the work done by the defect search and the cluster finders of
+ * the reference and implicit engines, compiled in only with
+ * -DDMND_WORK_COUNTERS (meson setup -Dwork_counters=true). Without it,
+ * WORK_COUNT(...) expands to nothing, so the hot loops are untouched.
+ *
+ * Counts accumulate per thread from the last reset(); dmnd_dilute resets
+ * them at the start of each run and writes them to the statfile as "work".
+ */
+
+namespace work_counters {
+
+struct counts {
+    // breadth-first defect searches (find_defect_tree)
+    uint64_t bfs_pushed = 0;
+    uint64_t bfs_popped = 0;
+    uint64_t bfs_peak_queue = 0;  // most nodes pushed but not yet popped
+
+    // defect paths by length: found intact, and excised (at least one of
+    // their links still alive when their turn came)
+    std::map<size_t, uint64_t> paths_found;
+    std::map<size_t, uint64_t> paths_excised;
+
+    uint64_t erase_link_calls = 0;
+
+    // depth-first cluster searches (find_connected), by cell dimension
+    uint64_t dfs_stack_peak[4] = {};
+    uint64_t neighbour_visits[4] = {};
+};
+
+inline counts& current(){
+    thread_local counts c;
+    return c;
+}
+
+inline void reset(){ current() = counts(); }
+
+inline void peak(uint64_t& p, uint64_t x){ p = std::max(p, x); }
+
+inline nlohmann::json to_json(const counts& c){
+    static const char* dim_name[4] = {"point", "link", "plaq", "vol"};
+    nlohmann::json j = {};
+    j["bfs_pushed"] = c.bfs_pushed;
+    j["bfs_popped"] = c.bfs_popped;
+    j["bfs_peak_queue"] = c.bfs_peak_queue;
+    j["paths_found"] = nlohmann::json::object();
+    for (const auto& [len, n] : c.paths_found) j["paths_found"][std::to_string(len)] = n;
+    j["paths_excised"] = nlohmann::json::object();
+    for (const auto& [len, n] : c.paths_excised) j["paths_excised"][std::to_string(len)] = n;
+    j["erase_link_calls"] = c.erase_link_calls;
+    for (int dim=1; dim<=3; dim++){
+        j[std::string(dim_name[dim])+"_dfs_stack_peak"] = c.dfs_stack_peak[dim];
+        j[std::string(dim_name[dim])+"_neighbour_visits"] = c.neighbour_visits[dim];
+    }
+    return j;
+}
+
+} // end namespace work_counters
+
+// Runs its statements with 'work' bound to the current counts, when compiled in
+#ifdef DMND_WORK_COUNTERS
+#define WORK_COUNT(...) do { auto& work = work_counters::current(); __VA_ARGS__; } while (0)
+#else
+#define WORK_COUNT(...) do {} while (0)
+#endif
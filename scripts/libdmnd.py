@@ -0,0 +1,194 @@
+#!/usr/bin/env python3
+"""
+ctypes bindings for libdmnd (include/dmnd.h), to run many realisations of
+the implicit engine in one process:
+
+    with Lattice([[L, 0, 0], [0, L, 0], [0, 0, L]]) as lat:
+        for seed in range(1000):
+            res = lat.realise(seed=seed, p=0.1, neighbours=[2, 4])
+            print(res['link']['P_inf'])
+
+The library is looked up in $DMND_LIB, then next to the build directory.
+"""
+import os
+import sys
+import ctypes as ct
+import argparse
+import numpy as np
+
+
+API_VERSION = 1
+MAX_PATH_LEN = 32
+STRATEGIES = {'random': 0, 'Zr4': 1, 'specific': 2}
+DIMS = ('link', 'plaq', 'vol')
+
+
+class Params(ct.Structure):
+    _fields_ = [
+        ('seed', ct.c_uint64),
+        ('dilution_prob', ct.c_double),
+        ('strategy', ct.c_int32),
+        ('cascade', ct.c_int32),
+        ('specific_ids', ct.POINTER(ct.c_int32)),
+        ('n_specific_ids', ct.c_size_t),
+        ('neighbours', ct.POINTER(ct.c_int32)),
+        ('n_neighbours', ct.c_size_t),
+        ('keep_labels', ct.c_int32),
+    ]
+
+
+class ClusterStats(ct.Structure):
+    _fields_ = [
+        ('n_alive', ct.c_uint64),
+        ('n_clusters', ct.c_uint64),
+        ('largest', ct.c_uint64),
+        ('second_largest', ct.c_uint64),
+        ('P_inf', ct.c_double),
+        ('mean_size', ct.c_double),
+        ('largest_Rg', ct.c_double),
+        ('wraps', ct.c_int32),
+        ('reserved', ct.c_int32),
+    ]
+
+
+class Result(ct.Structure):
+    _fields_ = [
+        ('clusters', ClusterStats * 3),
+        ('n_dimers', ct.c_uint64 * (MAX_PATH_LEN + 1)),
+        ('n_generations', ct.c_uint64),
+    ]
+
+
+def load_library(path=None):
+    if path is None:
+        path = os.environ.get('DMND_LIB')
+    if path is None:
+        here = os.path.dirname(os.path.abspath(__file__))
+        path = os.path.join(here, '..', 'build', 'libdmnd.so')
+    lib = ct.CDLL(path)
+
+    lib.dmnd_api_version.restype = ct.c_int
+    lib.dmnd_last_error.restype = ct.c_char_p
+    lib.dmnd_lattice_new.argtypes = [ct.POINTER(ct.c_int64), ct.c_uint]
+    lib.dmnd_lattice_new.restype = ct.c_void_p
+    lib.dmnd_lattice_free.argtypes = [ct.c_void_p]
+    lib.dmnd_lattice_size.argtypes = [ct.c_void_p, ct.c_int]
+    lib.dmnd_lattice_size.restype = ct.c_uint64
+    lib.dmnd_realise.argtypes = [ct.c_void_p, ct.POINTER(Params), ct.POINTER(Result)]
+    lib.dmnd_realise.restype = ct.c_int
+    lib.dmnd_cluster_sizes.argtypes = [ct.c_void_p, ct.c_int,
+                                       ct.POINTER(ct.c_uint64), ct.c_size_t]
+    lib.dmnd_cluster_sizes.restype = ct.c_int64
+    lib.dmnd_cluster_labels.argtypes = [ct.c_void_p, ct.c_int,
+                                        ct.POINTER(ct.c_uint32), ct.c_size_t]
+    lib.dmnd_cluster_labels.restype = ct.c_int
+
+    if lib.dmnd_api_version() != API_VERSION:
+        raise RuntimeError(f"{path} implements API version {lib.dmnd_api_version()}, "
+                           f"expected {API_VERSION}")
+    return lib
+
+
+def _int32_array(values):
+    arr = (ct.c_int32 * len(values))(*values)
+    return arr, len(values)
+
+
+class Lattice:
+    """
+    One supercell, reused for every realisation.
+    Z lists the supercell vectors Z1, Z2, Z3 as rows, as on the command line.
+    """
+    def __init__(self, Z, block=0, lib=None):
+        self.handle = None
+        self.lib = lib if lib is not None else load_library()
+        # dmnd.h takes Z(i,j) row-major, with the supercell vectors as columns
+        Zc = np.asarray(Z, dtype=np.int64).T.copy()
+        self.handle = self.lib.dmnd_lattice_new(
+            Zc.ctypes.data_as(ct.POINTER(ct.c_int64)), block)
+        if not self.handle:
+            raise RuntimeError(self._error())
+
+    def _error(self):
+        return self.lib.dmnd_last_error().decode()
+
+    def close(self):
+        if self.handle:
+            self.lib.dmnd_lattice_free(self.handle)
+            self.handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+    def size(self, dim):
+        return self.lib.dmnd_lattice_size(self.handle, dim)
+
+    def realise(self, seed, p, strategy='random', neighbours=(), cascade=False,
+                specific_ids=(), keep_labels=False):
+        """
+        Runs one realisation. Returns a dict holding, for each of 'link',
+        'plaq' and 'vol', the observables of .stats.json, and 'n_dimers'
+        (length -> paths excised from the original defects).
+        """
+        ids, n_ids = _int32_array(list(specific_ids))
+        nn, n_nn = _int32_array(list(neighbours))
+        params = Params(seed, p, STRATEGIES[strategy], int(cascade),
+                        ids, n_ids, nn, n_nn, int(keep_labels))
+        res = Result()
+        if self.lib.dmnd_realise(self.handle, ct.byref(params), ct.byref(res)) != 0:
+            raise RuntimeError(self._error())
+
+        out = {}
+        for name, c in zip(DIMS, res.clusters):
+            out[name] = {f: getattr(c, f) for f, _ in ClusterStats._fields_
+                         if f != 'reserved'}
+            out[name]['wraps'] = bool(c.wraps)
+        out['n_dimers'] = {n: res.n_dimers[n] for n in sorted(set(neighbours))}
+        out['n_generations'] = res.n_generations
+        return out
+
+    def cluster_sizes(self, dim):
+        """Cluster sizes of the last realisation, dim 1 (links) to 3 (vols)"""
+        n = self.lib.dmnd_cluster_sizes(self.handle, dim, None, 0)
+        if n < 0:
+            raise RuntimeError(self._error())
+        buf = np.empty(n, dtype=np.uint64)
+        self.lib.dmnd_cluster_sizes(self.handle, dim,
+                                    buf.ctypes.data_as(ct.POINTER(ct.c_uint64)), n)
+        return buf
+
+    def cluster_labels(self, dim):
+        """Per-cell labels of the last realisation, which must keep_labels"""
+        buf = np.empty(self.size(dim), dtype=np.uint32)
+        if self.lib.dmnd_cluster_labels(self.handle, dim,
+                                        buf.ctypes.data_as(ct.POINTER(ct.c_uint32)),
+                                        len(buf)) != 0:
+            raise RuntimeError(self._error())
+        return buf
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Wrapping probability of links over many seeds, in one process")
+    parser.add_argument('L', type=int)
+    parser.add_argument('-p', '--dilution_prob', type=float, required=True)
+    parser.add_argument('-N', '--n_seeds', type=int, default=100)
+    parser.add_argument('-n', '--neighbours', type=int, nargs='*', default=[])
+    args = parser.parse_args()
+
+    L = args.L
+    with Lattice([[L, 0, 0], [0, L, 0], [0, 0, L]]) as lat:
+        wraps = [lat.realise(seed, args.dilution_prob, neighbours=args.neighbours)['link']['wraps']
+                 for seed in range(args.n_seeds)]
+    print(f"L={L} p={args.dilution_prob}: links wrap in {np.mean(wraps):.3f} of {args.n_seeds} seeds")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -3,6 +3,8 @@ import os
 import re
 import sys
 import json
+import time
+import fcntl
 import sqlite3
 import argparse
 import numpy as np
@@ -28,12 +30,18 @@ sqlite3.register_adapter(np.ndarray, adapt_array)
 sqlite3.register_converter("array", convert_array)
 
 
+def optional_array(x):
+    """An array, or None for statistics the run did not compute (dmnd_dilute --stats)."""
+    return None if x is None else np.array(x)
+
+
 # Regex to parse metadata from filename
 FILENAME_REGEX = re.compile(
     r'Z1=([\d\-]+,[\d\-]+,[\d\-]+);'
     r'Z2=([\d\-]+,[\d\-]+,[\d\-]+);'
     r'Z3=([\d\-]+,[\d\-]+,[\d\-]+);'
     r'nn(=[\d,]*);'
+    r'(?:cascade;)?'
     r'(p|pZr)=([\d.]+);'
     r'seed=([a-f0-9]+);'
     r'\.stats\.json$'
@@ -58,13 +66,99 @@ def parse_filename_metadata(filename):
         Z2=match.group(2),
         Z3=match.group(3),
         nn=match.group(4)[1:],
+        cascade=';cascade;' in filename,
         strategy=strat,
         p=float(match.group(6)),
         seed=match.group(7),
+        engine='reference',
+        table=table
+    )
+
+
+def params_metadata(params):
+    """
+    As parse_filename_metadata, from the parameters of a manifest record
+    (every value a string, flags true)
+    """
+    if 'p' in params:
+        strat, table, p = 'random', 'stats_random', params['p']
+    elif 'pZr' in params:
+        strat, table, p = 'Zr', 'stats_Zr', params['pZr']
+    else:
+        raise ValueError(f"Run {params} has no dilution probability")
+
+    return dict(
+        Z1=params['Z1'],
+        Z2=params['Z2'],
+        Z3=params['Z3'],
+        nn=params.get('nn', ''),
+        cascade=params.get('cascade') is True,
+        strategy=strat,
+        p=float(p),
+        seed=params['seed'],
+        engine=params.get('engine', 'reference'),
         table=table
     )
 
 
+MANIFEST = "manifest.jsonl"
+
+
+def params_of(name):
+    """The parameters of a run name "k1=v1;k2=v2;flag;", as run_key.hpp"""
+    params = {}
+    for field in name.split(';'):
+        if field:
+            k, eq, v = field.partition('=')
+            params[k] = v if eq else True
+    return params
+
+
+def key_of(name):
+    """The key dmnd_dilute files the run 'name' under, as run_key.hpp"""
+    canonical = json.dumps(params_of(name), sort_keys=True, separators=(',', ':')).encode()
+    h = 0xcbf29ce484222325
+    for b in canonical:
+        h = ((h ^ b) * 0x100000001b3) & 0xffffffffffffffff
+    return f"{h:016x}"
+
+
+def read_manifest(directory):
+    """The records of <directory>/manifest.jsonl, one per completed run"""
+    path = os.path.join(directory, MANIFEST)
+    if not os.path.exists(path):
+        return []
+    with open(path) as f:
+        return [json.loads(line) for line in f if line.strip()]
+
+
+def list_runs(directory):
+    """
+    (path relative to directory, metadata) of every statfile: those listed
+    in the manifest that dmnd_dilute keeps, then any flat statfiles named
+    by their parameters, as older builds wrote them
+    """
+    runs = []
+    seen = set()  # a run redone with --force is listed again
+    for rec in read_manifest(directory):
+        try:
+            metadata = params_metadata(rec['params'])
+        except (KeyError, ValueError):
+            continue
+        for f in rec['files']:
+            if f.endswith(".stats.json") and f not in seen:
+                seen.add(f)
+                runs.append((f, metadata))
+
+    for f in os.listdir(directory):
+        if f.endswith(".stats.json"):
+            try:
+                runs.append((f, parse_filename_metadata(f)))
+            except ValueError:
+                pass
+    return runs
+
+
 def parse_stats_file(filepath):
     with open(filepath, 'r') as f:
         return json.load(f)
@@ -81,8 +175,10 @@ def create_database(db_path):
                 Z2 TEXT,
                 Z3 TEXT,
                 nn TEXT,
+                cascade BOOLEAN,
                 p REAL,
                 seed TEXT,
+                engine TEXT,
                 n_dimers_2 INTEGER,
                 n_dimers_4 INTEGER,
                 links INTEGER,
@@ -92,18 +188,106 @@ def create_database(db_path):
                 n_link_parts INTEGER,
                 links_wrap BOOLEAN,
                 link_cluster_dist BLOB,
+                link_largest INTEGER,
+                link_second_largest INTEGER,
+                link_P_inf REAL,
+                link_mean_size REAL,
+                link_largest_Rg REAL,
                 n_plaq_parts INTEGER,
                 plaqs_wrap BOOLEAN,
                 plaq_cluster_dist BLOB,
+                plaq_largest INTEGER,
+                plaq_second_largest INTEGER,
+                plaq_P_inf REAL,
+                plaq_mean_size REAL,
+                plaq_largest_Rg REAL,
                 n_vol_parts INTEGER,
                 vols_wrap BOOLEAN,
-                vol_cluster_dist BLOB
+                vol_cluster_dist BLOB,
+                vol_largest INTEGER,
+                vol_second_largest INTEGER,
+                vol_P_inf REAL,
+                vol_mean_size REAL,
+                vol_largest_Rg REAL
             )
         ''')
+    # Work counters, from builds configured with -Dwork_counters=true
+    cursor.execute('''
+        CREATE TABLE IF NOT EXISTS work (
+            Z1 TEXT,
+            Z2 TEXT,
+            Z3 TEXT,
+            nn TEXT,
+            cascade BOOLEAN,
+            strategy TEXT,
+            p REAL,
+            seed TEXT,
+            engine TEXT,
+            bfs_pushed INTEGER,
+            bfs_popped INTEGER,
+            bfs_peak_queue INTEGER,
+            paths_found TEXT,
+            paths_excised TEXT,
+            erase_link_calls INTEGER,
+            link_dfs_stack_peak INTEGER,
+            link_neighbour_visits INTEGER,
+            plaq_dfs_stack_peak INTEGER,
+            plaq_neighbour_visits INTEGER,
+            vol_dfs_stack_peak INTEGER,
+            vol_neighbour_visits INTEGER
+        )
+    ''')
+    for table in ["stats_random", "stats_Zr"]:
+        add_missing_columns(cursor, table, ADDED_STATS_COLUMNS)
+    add_missing_columns(cursor, "work", [('engine', 'TEXT', "'reference'")])
     conn.commit()
     return conn
 
 
+# Columns of the stats tables added after their first version, as (name,
+# type, value of the rows written before): those runs had no --cascade, and
+# only the reference engine existed. Cluster observables they did not
+# compute are NULL.
+ADDED_STATS_COLUMNS = [
+    ('cascade', 'BOOLEAN', '0'),
+    ('engine', 'TEXT', "'reference'"),
+] + [(f'{dim}_{obs}', kind, None)
+     for dim in ['link', 'plaq', 'vol']
+     for obs, kind in [('largest', 'INTEGER'), ('second_largest', 'INTEGER'),
+                       ('P_inf', 'REAL'), ('mean_size', 'REAL'),
+                       ('largest_Rg', 'REAL')]]
+
+
+def add_missing_columns(cursor, table, columns):
+    """Adds to a table made by an older version the columns it lacks"""
+    present = {row[1] for row in cursor.execute(f"PRAGMA table_info({table})")}
+    for name, kind, default in columns:
+        if name not in present:
+            clause = f" DEFAULT {default}" if default is not None else ""
+            cursor.execute(f"ALTER TABLE {table} ADD COLUMN {name} {kind}{clause}")
+
+
+WORK_COLUMNS = [
+    'bfs_pushed', 'bfs_popped', 'bfs_peak_queue', 'paths_found', 'paths_excised',
+    'erase_link_calls',
+    'link_dfs_stack_peak', 'link_neighbour_visits',
+    'plaq_dfs_stack_peak', 'plaq_neighbour_visits',
+    'vol_dfs_stack_peak', 'vol_neighbour_visits'
+]
+
+
+def parse_work(metadata, stats_data):
+    """The row of the work table, or None if the run counted no work"""
+    work = stats_data.get("work")
+    if work is None:
+        return None
+    values = [json.dumps(work.get(c)) if c.startswith('paths_') else work.get(c)
+              for c in WORK_COLUMNS]
+    return ('work', metadata['Z1'], metadata['Z2'], metadata['Z3'], metadata['nn'],
+            metadata['cascade'], metadata['strategy'], metadata['p'], metadata['seed'],
+            metadata['engine'], *values)
+
+
 def parse_record(metadata, stats_data):
 #    if stats_data is None:
 #        raise ValueError("stats_data invalid")
@@ -123,8 +307,10 @@ def parse_record(metadata, stats_data):
         metadata['Z2'],
         metadata['Z3'],
         metadata['nn'],
+        metadata['cascade'],
         metadata['p'],
         metadata['seed'],
+        metadata['engine'],
         n_dimers.get('2', 0),
         n_dimers.get('4', 0),
         counts.get('links'),
@@ -133,32 +319,46 @@ def parse_record(metadata, stats_data):
         counts.get('vols'),
         perc.get('n_link_parts'),
         perc.get('links_wrap'),
-        np.array(perc.get('link_cluster_dist')),
+        optional_array(perc.get('link_cluster_dist')),
+        perc.get('link_largest'),
+        perc.get('link_second_largest'),
+        perc.get('link_P_inf'),
+        perc.get('link_mean_size'),
+        perc.get('link_largest_Rg'),
         perc.get('n_plaq_parts'),
         perc.get('plaqs_wrap'),
-        np.array(perc.get('plaq_cluster_dist')),
+        optional_array(perc.get('plaq_cluster_dist')),
+        perc.get('plaq_largest'),
+        perc.get('plaq_second_largest'),
+        perc.get('plaq_P_inf'),
+        perc.get('plaq_mean_size'),
+        perc.get('plaq_largest_Rg'),
         perc.get('n_vol_parts'),
         perc.get('vols_wrap'),
-        np.array(perc.get('vol_cluster_dist'))
+        optional_array(perc.get('vol_cluster_dist')),
+        perc.get('vol_largest'),
+        perc.get('vol_second_largest'),
+        perc.get('vol_P_inf'),
+        perc.get('vol_mean_size'),
+        perc.get('vol_largest_Rg')
     )
 
 
 def process_single_file(args):
     """Process a single file - designed to be called in parallel."""
-    filename, directory = args
+    filename, metadata, directory = args
     filepath = os.path.join(directory, filename)
     try:
-        metadata = parse_filename_metadata(filename)
         stats_data = parse_stats_file(filepath)
-        return parse_record(metadata, stats_data)
+        return [parse_record(metadata, stats_data), parse_work(metadata, stats_data)]
     except Exception as e:
         print(f"Error processing {filename}: {e}")
-        return None
+        return []
 
 
 def insert_chunk(cursor, data_to_insert):
     """Insert records into the proper table based on their source."""
-    grouped = {'stats_random': [], 'stats_Zr': []}
+    grouped = {'stats_random': [], 'stats_Zr': [], 'work': []}
     for rec in data_to_insert:
         if rec is None:
             continue
@@ -169,19 +369,28 @@ def insert_chunk(cursor, data_to_insert):
         if not records:
             continue
         print(f"\nInserting {len(records)} records into {table}...")
+        if table == 'work':
+            columns = ['Z1', 'Z2', 'Z3', 'nn', 'cascade', 'strategy', 'p', 'seed', 'engine'] + WORK_COLUMNS
+            cursor.executemany(
+                f"INSERT INTO work ({', '.join(columns)}) VALUES ({', '.join('?' * len(columns))})",
+                records)
+            continue
         cursor.executemany(f'''
             INSERT INTO {table} (
-                Z1, Z2, Z3, nn, p, seed,
+                Z1, Z2, Z3, nn, cascade, p, seed, engine,
                 n_dimers_2, n_dimers_4,
                 links, plaqs, points, vols,
                 n_link_parts, links_wrap, link_cluster_dist,
+                link_largest, link_second_largest, link_P_inf, link_mean_size, link_largest_Rg,
                 n_plaq_parts, plaqs_wrap, plaq_cluster_dist,
-                n_vol_parts, vols_wrap, vol_cluster_dist
-            ) VALUES (?, ?, ?, ?, ?, ?,
+                plaq_largest, plaq_second_largest, plaq_P_inf, plaq_mean_size, plaq_largest_Rg,
+                n_vol_parts, vols_wrap, vol_cluster_dist,
+                vol_largest, vol_second_largest, vol_P_inf, vol_mean_size, vol_largest_Rg
+            ) VALUES (?, ?, ?, ?, ?, ?, ?, ?,
                       ?, ?, ?, ?, ?, ?,
-                      ?, ?, ?,
-                      ?, ?, ?,
-                      ?, ?, ?)
+                      ?, ?, ?, ?, ?, ?, ?, ?,
+                      ?, ?, ?, ?, ?, ?, ?, ?,
+                      ?, ?, ?, ?, ?, ?, ?, ?)
         ''', records)
 
 
@@ -193,16 +402,16 @@ def process_directory(directory, db_path, n_workers=None, chunk_size=1000):
     conn = create_database(db_path)
     cursor = conn.cursor()
 
-    file_list = [f for f in os.listdir(directory) if f.endswith(".stats.json")]
+    runs = list_runs(directory)
+    file_list = [f for f, _ in runs]
     print(f"Found {len(file_list)} files to process using {n_workers} workers")
 
-    args_list = [(filename, directory) for filename in file_list]
+    args_list = [(filename, metadata, directory) for filename, metadata in runs]
 
     data_to_insert = []
     with Pool(processes=n_workers) as pool:
         for i, result in enumerate(pool.imap(process_single_file, args_list)):
-            if result is not None:
-                data_to_insert.append(result)
+            data_to_insert += [rec for rec in result if rec is not None]
 
             if (i + 1) % 100 == 0:
                 print(f"Processed {i + 1}/{len(file_list)} ({100.0 * (i + 1) / len(file_list):.1f}%)")
@@ -239,8 +448,38 @@ if __name__ == "__main__":
         trashdir = os.path.join(args.DB_REPO, 'trash')
         os.makedirs(trashdir, exist_ok=True)
 
-        for f in file_list:
+        # Retire the manifest along with every file of the merged runs,
+        # keeping the runs that completed while merging
+        to_move = list(file_list)
+        manifest = os.path.join(args.DB_REPO, MANIFEST)
+        if os.path.exists(manifest):
+            merged = set(file_list)
+            retired = os.path.join(trashdir, f"manifest.{int(time.time())}.jsonl")
+            late = []
+            with open(manifest) as f:
+                # Renamed under the lock that run_key::record appends under;
+                # a run that opened the manifest before the rename finds it
+                # renamed once it gets the lock, and reopens the live path
+                fcntl.flock(f, fcntl.LOCK_EX)
+                os.rename(manifest, retired)
+                for line in f:
+                    if not line.strip():
+                        continue
+                    files = json.loads(line)['files']
+                    if merged.intersection(files):
+                        to_move += [x for x in files if x not in merged]
+                    else:
+                        late.append(line)
+            if late:
+                with open(manifest, 'a') as f:
+                    fcntl.flock(f, fcntl.LOCK_EX)
+                    f.writelines(late)
+
+        for f in to_move:
             src = os.path.join(args.DB_REPO, f)
             dst = os.path.join(trashdir, f)
+            if not os.path.exists(src):
+                continue
+            os.makedirs(os.path.dirname(dst), exist_ok=True)
             os.rename(src, dst)
 
@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+"""
+Zero-copy access to the cluster label files written by
+`dmnd_dilute --engine implicit --save_labels` (see include/cluster_labels.hpp).
+"""
+import sys
+import argparse
+import numpy as np
+
+
+FORMAT_VERSION = 1
+
+HEADER_DTYPE = np.dtype([
+    ('magic', 'S8'),
+    ('version', '<u4'),
+    ('dim', '<u4'),
+    ('Z', '<i8', (3, 3)),
+    ('n_cells', '<u8'),
+    ('n_clusters', '<u8'),
+    ('clusters_at', '<u8'),
+    ('labels_at', '<u8'),
+])
+
+CLUSTER_DTYPE = np.dtype([
+    ('size', '<u8'),
+    ('wraps', '<u4'),
+    ('winding', '<i4', (3,)),
+])
+
+
+def load_labels(path):
+    """
+    Maps a label file read-only.
+    Returns (header, clusters, labels): the header as a numpy record, the
+    cluster table as a structured array, and the per-cell labels indexed by
+    row-major cell id (0: dead cell, otherwise 1 + row in the table).
+    """
+    header = np.memmap(path, dtype=HEADER_DTYPE, mode='r', shape=(1,))[0]
+    if header['magic'] != b'DMNDLBL' or header['version'] != FORMAT_VERSION:
+        raise ValueError(f"{path} is not a label file of version {FORMAT_VERSION}")
+
+    clusters = np.memmap(path, dtype=CLUSTER_DTYPE, mode='r',
+                         offset=int(header['clusters_at']),
+                         shape=(int(header['n_clusters']),))
+    labels = np.memmap(path, dtype='<u4', mode='r',
+                       offset=int(header['labels_at']),
+                       shape=(int(header['n_cells']),))
+    return header, clusters, labels
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Summarise cluster label files")
+    parser.add_argument('files', nargs='+', help="*_labels.bin files")
+    args = parser.parse_args()
+
+    for path in args.files:
+        header, clusters, labels = load_labels(path)
+        print(f"{path}: dim {header['dim']}, {header['n_cells']} cells, "
+              f"{header['n_clusters']} clusters, {np.count_nonzero(labels)} alive")
+        if len(clusters):
+            big = np.argmax(clusters['size'])
+            print(f"  largest: {clusters['size'][big]} cells, "
+                  f"wraps {bool(clusters['wraps'][big])}, "
+                  f"winding {tuple(int(w) for w in clusters['winding'][big])}")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
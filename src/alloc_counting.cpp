@@ -0,0 +1,83 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include "alloc_counters.hpp"
+/**
+ * Replacements of the global operator new and delete that report every
+ * allocation to alloc_counters.hpp. Linked only into builds configured
+ * with -Dalloc_counters=true.
+ *
+ * Each block is preceded by a header holding its size, which the unsized
+ * forms of delete need to keep the live byte count, and whether it was
+ * counted at all (allocations inside the counters are not).
+ */
+
+namespace {
+
+struct header {
+    uint64_t size;
+    uint32_t offset;   // from the start of the malloc'd block to the user's
+    uint32_t counted;
+};
+static_assert(sizeof(header) == 16);
+
+void* allocate(size_t n, size_t align, bool nothrow){
+    const size_t offset = std::max<size_t>(align, alignof(std::max_align_t));
+    void* raw;
+    if (align <= alignof(std::max_align_t)){
+        raw = malloc(n + offset);
+    } else {
+        raw = aligned_alloc(align, (n + offset + align - 1) / align * align);
+    }
+    if (raw == nullptr){
+        if (nothrow) return nullptr;
+        throw std::bad_alloc();
+    }
+
+    void* p = static_cast<char*>(raw) + offset;
+    auto h = static_cast<header*>(p) - 1;
+    h->size = n;
+    h->offset = offset;
+    h->counted = !alloc_counters::in_hook;
+    if (h->counted) alloc_counters::on_alloc(n);
+    return p;
+}
+
+void deallocate(void* p){
+    if (p == nullptr) return;
+    auto h = static_cast<header*>(p) - 1;
+    if (h->counted) alloc_counters::on_free(h->size);
+    free(static_cast<char*>(p) - h->offset);
+}
+
+} // end anonymous namespace
+
+
+void* operator new(size_t n){ return allocate(n, 0, false); }
+void* operator new[](size_t n){ return allocate(n, 0, false); }
+void* operator new(size_t n, const std::nothrow_t&) noexcept { return allocate(n, 0, true); }
+void* operator new[](size_t n, const std::nothrow_t&) noexcept { return allocate(n, 0, true); }
+void* operator new(size_t n, std::align_val_t a){ return allocate(n, size_t(a), false); }
+void* operator new[](size_t n, std::align_val_t a){ return allocate(n, size_t(a), false); }
+void* operator new(size_t n, std::align_val_t a, const std::nothrow_t&) noexcept {
+    return allocate(n, size_t(a), true);
+}
+void* operator new[](size_t n, std::align_val_t a, const std::nothrow_t&) noexcept {
+    return allocate(n, size_t(a), true);
+}
+
+void operator delete(void* p) noexcept { deallocate(p); }
+void operator delete[](void* p) noexcept { deallocate(p); }
+void operator delete(void* p, size_t) noexcept { deallocate(p); }
+void operator delete[](void* p, size_t) noexcept { deallocate(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { deallocate(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { deallocate(p); }
+void operator delete(void* p, std::align_val_t) noexcept { deallocate(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { deallocate(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { deallocate(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { deallocate(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { deallocate(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { deallocate(p); }
@@ -0,0 +1,388 @@
+#include <argparse.hpp>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <lattice_IO.hpp>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// LatticeLab
+#include <chain.hpp>
+#include <cell_geometry.hpp>
+#include <preset_cellspecs.hpp>
+#include <UnitCellSpecifier.hpp>
+
+#include "dilution.hpp"
+#include "format_bits.hpp"
+#include "run_key.hpp"
+/**
+ * Dilutes a diamond lattice as dmnd_dilute does, then counts the paths of
+ * each requested length connecting pairs of defect tetras. Nothing is ever
+ * erased: diluted spins are only flagged, so the lattice is built once and
+ * reused for every seed, and every length sees the same diluted lattice
+ * (unlike dmnd_dilute, where shorter paths are excised first).
+ */
+
+using namespace CellGeometry;
+using namespace nlohmann;
+using namespace std;
+
+
+// 'index' numbers points and links in the key order of their SparseMap
+struct Tetra : public Cell<0> {
+    uint32_t index = 0;
+    bool on_path = false;
+};
+
+struct Spin : public Cell<1> {
+    uint32_t index = 0;
+    bool deleted = false;
+};
+
+struct Plaq : public Cell<2> {
+};
+
+struct Vol : public Cell<3> {
+};
+
+typedef PeriodicVolLattice<Tetra, Spin, Plaq, Vol> Lattice;
+
+
+// Number of undiluted spins on tetra t
+inline unsigned live_coordination(const Tetra* t){
+    unsigned c = 0;
+    for (const auto& [l, _] : t->coboundary){
+        c += !static_cast<const Spin*>(l)->deleted;
+    }
+    return c;
+}
+
+
+/**
+ * Depth-first enumeration of self-avoiding paths of 'remaining' further
+ * spins from curr, counting the paths that end on a defect tetra.
+ * @param hits: number of paths reaching each defect tetra
+ */
+void count_defect_paths(Tetra* curr, unsigned remaining,
+        std::map<const Tetra*, size_t>& hits){
+    if (remaining == 0){
+        if (live_coordination(curr) < 4) hits[curr]++;
+        return;
+    }
+
+    curr->on_path = true;
+    for (const auto& [l, _] : curr->coboundary){
+        auto s = static_cast<const Spin*>(l);
+        if (s->deleted) continue;
+        for (const auto& [p, _m] : s->boundary){
+            auto next = static_cast<Tetra*>(p);
+            if (next->on_path) continue;
+            count_defect_paths(next, remaining-1, hits);
+        }
+    }
+    curr->on_path = false;
+}
+
+
+struct path_stats {
+    size_t n_paths = 0;
+    // number of paths joining a pair -> number of such defect pairs
+    std::map<size_t, size_t> multiplicity;
+};
+
+
+path_stats count_pair_paths(const std::vector<Tetra*>& defect_tetras, unsigned len){
+    path_stats res;
+    std::map<const Tetra*, size_t> hits;
+    for (auto t1 : defect_tetras){
+        hits.clear();
+        count_defect_paths(t1, len, hits);
+        for (const auto& [t2, m] : hits){
+            // every pair is seen from both ends, keep one
+            if (t1->index >= t2->index) continue;
+            res.n_paths += m;
+            res.multiplicity[m]++;
+        }
+    }
+    return res;
+}
+
+
+/**
+ * Depth-first enumeration of the self-avoiding paths of 'remaining' further
+ * spins from the end of 'path', appending each (as its list of tetras,
+ * origin first) to the list for its final tetra.
+ */
+void collect_half_paths(std::vector<Tetra*>& path, unsigned remaining,
+        std::unordered_map<const Tetra*, std::vector<std::vector<Tetra*>>>& by_end){
+    auto curr = path.back();
+    if (remaining == 0){
+        by_end[curr].push_back(path);
+        return;
+    }
+
+    curr->on_path = true;
+    for (const auto& [l, _] : curr->coboundary){
+        auto s = static_cast<const Spin*>(l);
+        if (s->deleted) continue;
+        for (const auto& [p, _m] : s->boundary){
+            auto next = static_cast<Tetra*>(p);
+            if (next->on_path) continue;
+            path.push_back(next);
+            collect_half_paths(path, remaining-1, by_end);
+            path.pop_back();
+        }
+    }
+    curr->on_path = false;
+}
+
+
+/**
+ * As count_pair_paths, meeting in the middle: every defect grows the paths
+ * of len/2 and len - len/2 spins, indexed by the tetra they end on, and a
+ * path between defects a < b is a short half from a joined to a long half
+ * from b at a common tetra, with no other tetra in common.
+ * This costs ~3^(len/2) per defect instead of ~3^len.
+ */
+path_stats count_pair_paths_bidirectional(const std::vector<Tetra*>& defect_tetras, unsigned len){
+    const unsigned h1 = len/2;
+    const unsigned h2 = len - h1;
+
+    std::unordered_map<const Tetra*, std::vector<std::vector<Tetra*>>> short_halves, long_halves;
+    std::vector<Tetra*> path;
+    for (auto t : defect_tetras){
+        path.assign(1, t);
+        collect_half_paths(path, h1, short_halves);
+        path.assign(1, t);
+        collect_half_paths(path, h2, long_halves);
+    }
+
+    // Two halves meeting at their last tetra share no other one
+    auto disjoint = [](const std::vector<Tetra*>& x, const std::vector<Tetra*>& y){
+        for (size_t i=0; i+1<x.size(); i++){
+            for (size_t j=0; j+1<y.size(); j++){
+                if (x[i] == y[j]) return false;
+            }
+        }
+        return true;
+    };
+
+    std::map<std::pair<const Tetra*, const Tetra*>, size_t> hits;
+    for (const auto& [mid, xs] : short_halves){
+        auto it = long_halves.find(mid);
+        if (it == long_halves.end()) continue;
+        for (const auto& x : xs){
+            for (const auto& y : it->second){
+                if (x.front()->index >= y.front()->index) continue;
+                if (disjoint(x, y)) hits[{x.front(), y.front()}]++;
+            }
+        }
+    }
+
+    path_stats res;
+    for (const auto& [_, m] : hits){
+        res.n_paths += m;
+        res.multiplicity[m]++;
+    }
+    return res;
+}
+
+
+void export_paths(
+        const filesystem::path& path,
+        const std::string& name,
+        const Lattice& lat,
+        size_t n_diluted,
+        size_t n_defects,
+        const std::map<unsigned, path_stats>& stats
+        ){
+    cout<<"Saving path counts to \n"<<path<<std::endl;
+
+    json j = {};
+    j["__version__"] = 2;
+    j["key"] = run_key::key_of(name);
+    j["params"] = run_key::params_of(name);
+    j["counts"] = {};
+    j["counts"]["points"] = lat.points.size();
+    j["counts"]["links"] = lat.links.size() - n_diluted;
+    j["counts"]["defects"] = n_defects;
+
+    j["paths"] = {};
+    for (const auto& [len, s] : stats){
+        size_t n_pairs = 0;
+        json hist = {};
+        for (const auto& [m, c] : s.multiplicity){
+            hist[std::to_string(m)] = c;
+            n_pairs += c;
+        }
+        auto key = std::to_string(len);
+        j["paths"][key]["n_paths"] = s.n_paths;
+        j["paths"][key]["n_pairs"] = n_pairs;
+        j["paths"][key]["multiplicity"] = hist;
+        cout << len << "-paths: " << s.n_paths << " joining " << n_pairs << " pairs\n";
+    }
+
+    std::ofstream of(path);
+    of << j;
+    of.close();
+}
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+/// MAIN PROGRAM
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+int main (int argc, const char *argv[]) {
+
+    argparse::ArgumentParser prog(argv[0]);
+    prog.add_argument("Z1")
+        .help("First lattice vector in primitive units (three integers) ")
+        .nargs(3)
+        .scan<'i', int>();
+    prog.add_argument("Z2")
+        .help("Second lattice vector in primitive units (three integers)")
+        .nargs(3)
+        .scan<'i', int>();
+    prog.add_argument("Z3")
+        .help("Third lattice vector in primitive units (three integers)")
+        .nargs(3)
+        .scan<'i', int>();
+
+    std::string outdir;
+    prog.add_argument("--output_dir", "-o")
+        .help("Path to output")
+        .required()
+        .store_into(outdir);
+
+    prog.add_argument("--force", "-f")
+        .help("Overwrites output files")
+        .default_value(false)
+        .implicit_value(true);
+
+    std::vector<int> neighbours;
+    prog.add_argument("--neighbours", "-n")
+        .help("Path lengths to count")
+        .required()
+        .scan<'i', int>()
+        .nargs(argparse::nargs_pattern::at_least_one)
+        .store_into(neighbours);
+
+    std::vector<int> spin_ids_to_delete;
+    prog.add_argument("--delete_spins", "-d")
+        .help("Specific spin indexes to delete.")
+        .default_value<std::vector<int>>({})
+        .nargs(argparse::nargs_pattern::at_least_one)
+        .store_into(spin_ids_to_delete);
+
+    double dilution_prob;
+    prog.add_argument("--dilution_prob","-p")
+        .help("Probability of deleting spin i")
+        .store_into(dilution_prob);
+
+    std::vector<std::string> seeds_s;
+    prog.add_argument("--seed", "-s")
+        .help("64-bit ints to seed the RNG, one realisation (and output file) each")
+        .nargs(argparse::nargs_pattern::at_least_one)
+        .store_into(seeds_s);
+
+    prog.add_argument("--dilution_strategy", "-y")
+        .choices("random", "Zr4", "specific")
+        .default_value("random");
+
+    int bidirectional_from;
+    prog.add_argument("--bidirectional_from")
+        .help("Paths at least this long are counted by meeting in the middle")
+        .scan<'i', int>()
+        .default_value(6)
+        .store_into(bidirectional_from);
+
+
+    try {
+        prog.parse_args(argc, argv);
+    } catch (const std::exception& err){
+        cerr << err.what() << endl;
+        cerr << prog;
+        std::exit(1);
+    }
+
+    ////////////////////////////////////////////////////////
+    /// End program argument definitions
+    ///
+
+    std::filesystem::path outpath(outdir);
+    if (! filesystem::exists(outpath) ){
+        throw std::runtime_error("Cannot open outdir");
+    }
+
+    std::stringstream base_name;
+
+    imat33_t supercell_spec;
+    base_name << parse_supercell_spec(supercell_spec, prog);
+    std::cout<<"Constructing supercell of dimensions \n"<<supercell_spec<<std::endl;
+
+    const auto spec = PrimitiveSpecifiers::DiamondSpec();
+    // sorted, as in dmnd_dilute, so that "-n 4 2" and "-n 2 4" share a key
+    sort_and_remove_duplicates(neighbours);
+    base_name << comma_separate("nn", neighbours);
+
+    auto erase_strat = prog.get<std::string>("--dilution_strategy");
+
+    Lattice lat(spec, supercell_spec);
+    index_cells(lat.points);
+    index_cells(lat.links);
+
+    for (const auto& seed_s : seeds_s){
+        uint64_t seed; // ugly hack for loading hex values
+        std::stringstream ss;
+        ss << std::hex << seed_s;
+        ss >> seed;
+
+        std::stringstream name;
+        name << base_name.str();
+
+        for (const auto& [_, s] : lat.links){
+            s->deleted = false;
+        }
+
+        cell_set<Spin> spins_to_yeet;
+        determine_deleted_spins(name, spins_to_yeet, lat, seed, erase_strat,
+                dilution_prob, spin_ids_to_delete);
+
+        auto outfile = run_key::output_path(outpath, name.str(), ".paths.json");
+        if (!prog.get<bool>("--force") && filesystem::exists(outfile)){
+            cerr << "Pathfile " << outfile << "already exists" << std::endl;
+            throw std::runtime_error("Pathfile exists");
+        }
+
+        cell_set<Tetra> defect_tetras;
+        for (auto s : spins_to_yeet){
+            s->deleted = true;
+            for (const auto& [p, _] : s->boundary){
+                defect_tetras.insert(static_cast<Tetra*>(p));
+            }
+        }
+        std::vector<Tetra*> defect_tetras_vec(defect_tetras.begin(), defect_tetras.end());
+
+        std::map<unsigned, path_stats> stats;
+        for (auto len : neighbours){
+            printf("[search] counting %d-paths between %zu defects\n", len, defect_tetras_vec.size());
+            stats[len] = len >= bidirectional_from ?
+                count_pair_paths_bidirectional(defect_tetras_vec, len) :
+                count_pair_paths(defect_tetras_vec, len);
+        }
+
+        export_paths(outfile, name.str(), lat, spins_to_yeet.size(), defect_tetras_vec.size(), stats);
+        run_key::record(outpath, name.str(), {outfile});
+    }
+
+    return 0;
+}
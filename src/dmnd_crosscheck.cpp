@@ -0,0 +1,834 @@
+#include <algorithm>
+#include <argparse.hpp>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include <XoshiroCpp.hpp>
+
+// LatticeLab
+#include <chain.hpp>
+#include <cell_geometry.hpp>
+#include <preset_cellspecs.hpp>
+#include <UnitCellSpecifier.hpp>
+
+#include "cell_set.hpp"
+#include "cluster_labels.hpp"
+#include "dilution.hpp"
+#include "format_bits.hpp"
+#include "geom_traverser.hpp"
+#include "implicit_diamond.hpp"
+#include "implicit_pipeline.hpp"
+#include "reference_pipeline.hpp"
+#include "replica_percolation.hpp"
+#include "slab_stream.hpp"
+#include "stats_json.hpp"
+/**
+ * Differential check of the fast engines against the pipelines they
+ * replace. Random cases (supercells, including non-diagonal Z, dilution
+ * strategies, p, seeds, path lengths, cascade) are run through
+ *  - layout:    the implicit engine tiled with every valid --block,
+ *               against row-major
+ *  - streaming: the streaming engine, against the implicit engine
+ *  - replicas:  all 64 replicas, against the implicit engine per seed
+ *  - reference: the implicit engine, against the reference engine on the
+ *               reference's own dilution
+ * and every field of the resulting statfiles is compared exactly. The first
+ * failure of each check is shrunk to a small reproducer. Exits 1 if any
+ * check failed.
+ *
+ * All engines visit cells in the implicit engine's canonical order (the
+ * reference engine as set up by reference_stats), so the only field that
+ * may legitimately differ is the radius of gyration of a cluster winding
+ * around the supercell, which depends on the path taken to unwrap it (see
+ * rg_is_defined). Differences there are reported as 'order-dependent' but
+ * do not fail a check.
+ */
+
+using namespace std;
+using json = nlohmann::json;
+
+
+// One realisation, as dmnd_dilute would be asked for it
+struct test_case {
+    imat33_t Z;
+    std::vector<int> lens;  // sorted, see search_lengths
+    bool cascade = false;
+    std::string strategy = "random";
+    double p = 0;
+    uint64_t seed = 0;
+    std::vector<int> ids;   // canonical link ids, for 'specific'
+
+    std::vector<int> column(int j) const { return {int(Z(0,j)), int(Z(1,j)), int(Z(2,j))}; }
+
+    // The run name, shared by every engine so that key and params agree
+    std::string name() const {
+        std::stringstream name;
+        name << comma_separate("Z1", column(0)) << comma_separate("Z2", column(1))
+            << comma_separate("Z3", column(2)) << comma_separate("nn", lens);
+        if (cascade) name << "cascade;";
+        char buf[1024];
+        if (strategy == "random"){
+            snprintf(buf, 1024, "p=%.04f;seed=%llx;", p, (unsigned long long)seed);
+            name << buf;
+        } else if (strategy == "Zr4"){
+            snprintf(buf, 1024, "pZr=%.04f;seed=%llx;", p/2, (unsigned long long)seed);
+            name << buf;
+        } else if (!ids.empty()){
+            name << comma_separate("d1", ids);
+        }
+        return name.str();
+    }
+
+    // Arguments reproducing the case, for dmnd_dilute or --replay
+    std::string args() const {
+        std::stringstream res;
+        for (int j=0; j<3; j++){
+            for (int i=0; i<3; i++) res << Z(i,j) << " ";
+        }
+        if (!lens.empty()){
+            res << "-n";
+            for (auto l : lens) res << " " << l;
+            res << " ";
+        }
+        if (cascade) res << "--cascade ";
+        res << "-y " << strategy;
+        if (strategy == "specific"){
+            if (!ids.empty()) res << " -d";
+            for (auto x : ids) res << " " << x;
+        } else {
+            res << " -p " << p << " --seed " << std::hex << seed << std::dec;
+        }
+        return res.str();
+    }
+};
+
+
+// p as run names give it, to four places
+inline double round_p(double p){ return std::round(p * 1e4) / 1e4; }
+
+
+// A field whose value differs between two engines
+struct field_diff {
+    std::string field;
+    json expected;
+    json found;
+    bool strict; // false if the difference is allowed
+};
+
+typedef std::function<bool(const std::string&)> strictness;
+
+
+// Appends the fields (as /-separated paths) where 'found' differs from 'expected'
+void diff_json(const json& expected, const json& found, const std::string& path,
+        const strictness& strict, std::vector<field_diff>& out){
+    if (expected.is_object() && found.is_object()){
+        std::set<std::string> keys;
+        for (auto it = expected.begin(); it != expected.end(); it++) keys.insert(it.key());
+        for (auto it = found.begin(); it != found.end(); it++) keys.insert(it.key());
+        for (const auto& k : keys){
+            diff_json(expected.value(k, json()), found.value(k, json()), path+"/"+k, strict, out);
+        }
+    } else if (expected != found){
+        out.push_back({path, expected, found, strict(path)});
+    }
+}
+
+
+inline bool has_strict(const std::vector<field_diff>& ms){
+    return std::any_of(ms.begin(), ms.end(), [](const field_diff& m){ return m.strict; });
+}
+
+
+static const char* dim_prefix[4] = {"point", "link", "plaq", "vol"};
+
+//////////////////////////////////////////////////////////////////////////////
+/// ENGINES
+
+struct implicit_run {
+    json stats;
+    bool winds[4] = {false, false, false, false}; // whether any cluster winds
+};
+
+// Clusters of dimension dim, and whether any of them winds around the
+// supercell (see cluster_labels::cluster_windings)
+template<int dim>
+std::vector<cluster_summary> clusters_and_windings(implicit_diamond& lat,
+        const imat33_t& Z, implicit_run& run){
+    auto res = find_connected<dim>(lat);
+    for (const auto& w : cluster_labels::cluster_windings<dim>(lat, Z, res.size())){
+        run.winds[dim] = run.winds[dim] || w[0] || w[1] || w[2];
+    }
+    return res;
+}
+
+implicit_run implicit_stats(const test_case& c, unsigned block=0){
+    implicit_diamond lat(c.Z, block);
+    auto links = deleted_links(lat, c.seed, c.strategy, c.p, c.ids);
+    auto n_dimers = dilute_and_excise(lat, links, c.lens, c.cascade, false);
+
+    implicit_run res;
+    auto connected_links = clusters_and_windings<1>(lat, c.Z, res);
+    auto connected_plaqs = clusters_and_windings<2>(lat, c.Z, res);
+    auto connected_vols = clusters_and_windings<3>(lat, c.Z, res);
+    res.stats = stats_to_json(c.name(), latstats_to_json(lat), lat.sc.n_cells,
+            connected_links, connected_plaqs, connected_vols, n_dimers, false);
+    return res;
+}
+
+
+// The radius of gyration of a cluster that winds around the supercell
+// depends on the path taken to unwrap it (see README). The statfile leaves
+// it out for every cluster that spans the supercell (spans_supercell), which
+// catches all winding ones unless a combination of the supercell vectors is
+// shorter than each of them. Ties for the largest cluster go to the first,
+// and clusters are listed by canonical root in every engine.
+bool rg_is_defined(const implicit_run& run, int dim){
+    return !run.winds[dim];
+}
+
+strictness unless_rg_undefined(const implicit_run& run){
+    return [run](const std::string& field){
+        for (int dim=1; dim<4; dim++){
+            if (field == std::string("/percolation/")+dim_prefix[dim]+"_largest_Rg"){
+                return rg_is_defined(run, dim);
+            }
+        }
+        return true;
+    };
+}
+
+
+json streaming_stats(const test_case& c){
+    diamond_geometry geo(c.Z);
+    streamed_dilution dil{geo, c.seed, c.p};
+
+    json counts = {};
+    uint64_t n_alive;
+    counts["points"] = geo.size(0);
+    auto connected_links = find_connected_streaming<1>(dil, n_alive);
+    counts["links"] = n_alive;
+    auto connected_plaqs = find_connected_streaming<2>(dil, n_alive);
+    counts["plaqs"] = n_alive;
+    auto connected_vols = find_connected_streaming<3>(dil, n_alive);
+    counts["vols"] = n_alive;
+    return stats_to_json(c.name(), counts, geo.sc.n_cells,
+            connected_links, connected_plaqs, connected_vols,
+            std::vector<std::map<size_t, size_t>>(), false);
+}
+
+
+// The statfiles of replicas seed..seed+63
+std::vector<json> replica_stats(const test_case& c){
+    diamond_geometry geo(c.Z);
+    replica_dilution dil(geo, c.seed, c.p);
+    auto connected_links = find_connected_replicas<1>(dil);
+    auto connected_plaqs = find_connected_replicas<2>(dil);
+    auto connected_vols = find_connected_replicas<3>(dil);
+
+    std::vector<json> res;
+    for (unsigned r=0; r<n_replicas; r++){
+        auto cr = c;
+        cr.seed = c.seed + r;
+        json counts = {};
+        counts["points"] = geo.size(0);
+        counts["links"] = connected_links.n_alive[r];
+        counts["plaqs"] = connected_plaqs.n_alive[r];
+        counts["vols"] = connected_vols.n_alive[r];
+        res.push_back(stats_to_json(cr.name(), counts, geo.sc.n_cells,
+                    connected_links.clusters[r], connected_plaqs.clusters[r],
+                    connected_vols.clusters[r],
+                    std::vector<std::map<size_t, size_t>>(), false));
+    }
+    return res;
+}
+
+
+// Canonical id of the implicit cell at position R
+inline uint64_t canonical_at(const diamond_geometry& geo, int dim, const ipos_t& R){
+    return geo.canonical_id(dim, geo.cell_at_position(dim, R));
+}
+
+
+// The reference link at the position of the canonical link id x
+inline Spin* reference_link(Lattice& lat, const diamond_geometry& geo, int x){
+    if (x < 0 || uint64_t(x) >= geo.size(1)){
+        throw std::out_of_range("Tried to delete spins at nonexistent index");
+    }
+    return &lat.get_link_at(geo.position(1, geo.id_of_canonical(1, x)));
+}
+
+
+/**
+ * The links the reference engine's own dilution deletes in case c, as
+ * canonical ids of the implicit lattice
+ */
+std::vector<int> reference_dilution(const test_case& c){
+    if (c.strategy == "specific") return c.ids;
+
+    Lattice lat(PrimitiveSpecifiers::DiamondSpec(), c.Z);
+    index_cells(lat.points);
+    index_cells(lat.links);
+    diamond_geometry geo(c.Z);
+
+    std::stringstream name;
+    std::vector<int> unused;
+    cell_set<Spin> spins_to_yeet;
+    determine_deleted_spins(name, spins_to_yeet, lat, c.seed, c.strategy, c.p, unused);
+
+    std::vector<int> res;
+    for (auto s : spins_to_yeet) res.push_back(canonical_at(geo, 1, s->position));
+    std::sort(res.begin(), res.end());
+    return res;
+}
+
+
+// The keys dmnd_dilute's reference engine takes for the canonical links ids
+std::vector<CellGeometry::sl_t> reference_keys(const test_case& c){
+    Lattice lat(PrimitiveSpecifiers::DiamondSpec(), c.Z);
+    index_cells(lat.links);
+    diamond_geometry geo(c.Z);
+
+    std::vector<CellGeometry::sl_t> keys;
+    for (const auto& [k, _] : lat.links) keys.push_back(k);
+
+    std::vector<CellGeometry::sl_t> res;
+    for (auto x : c.ids) res.push_back(keys[reference_link(lat, geo, x)->index]);
+    return res;
+}
+
+
+// The cells of 'elems' sorted by canonical id
+template<typename T>
+std::vector<T*> canonical_order(const diamond_geometry& geo, int dim,
+        const CellGeometry::SparseMap<CellGeometry::sl_t, T*>& elems){
+    std::vector<std::pair<uint64_t, T*>> keyed;
+    for (const auto& [_, x] : elems) keyed.push_back({canonical_at(geo, dim, x->position), x});
+    std::sort(keyed.begin(), keyed.end());
+    std::vector<T*> res;
+    for (const auto& [_, x] : keyed) res.push_back(x);
+    return res;
+}
+
+
+/**
+ * As run_reference, on the links 'c.ids' (canonical ids, c being
+ * 'specific'), except that cells are visited in the implicit engine's
+ * canonical order rather than the reference's key order: defects are
+ * searched in it, and clusters rooted at their member of lowest canonical
+ * id and listed by root. It also orders the search trees and excisions as
+ * the implicit tables do (index_sublattices), where run_reference keeps
+ * latticelab's incidence order. Together these make every field of the
+ * statfile independent of how latticelab numbers its cells.
+ */
+json reference_stats(const test_case& c){
+    Lattice lat(PrimitiveSpecifiers::DiamondSpec(), c.Z);
+    index_cells(lat.points);
+    index_cells(lat.links);
+    diamond_geometry geo(c.Z);
+    index_sublattices(lat, geo);
+
+    cell_set<Spin> spins_to_yeet;
+    for (auto x : c.ids) spins_to_yeet.insert(reference_link(lat, geo, x));
+
+    cell_set<Tetra> defect_tetras;
+    del_spins_get_dtetras(lat, spins_to_yeet, defect_tetras);
+
+    std::vector<Tetra*> worklist(defect_tetras.begin(), defect_tetras.end());
+    std::sort(worklist.begin(), worklist.end(), [&](const Tetra* a, const Tetra* b){
+        return canonical_at(geo, 0, a->position) < canonical_at(geo, 0, b->position);
+    });
+
+    for (const auto& [_, s] : lat.links){
+        s->origin = nullptr;
+    }
+    std::vector<std::map<size_t, size_t>> n_dimers;
+    std::vector<ipos_t> deleted_link_locs;
+    cell_set<Spin> deleted_links;
+    do {
+        n_dimers.emplace_back();
+        worklist = excise_defect_paths(lat, worklist, c.lens,
+                deleted_links, deleted_link_locs, n_dimers.back(), false);
+    } while (c.cascade && !worklist.empty());
+
+    const auto link_order = canonical_order(geo, 1, lat.links);
+    const auto plaq_order = canonical_order(geo, 2, lat.plaqs);
+    const auto vol_order = canonical_order(geo, 3, lat.vols);
+    auto connected_links = find_connected(lat, lat.links, false, &link_order);
+    auto connected_plaqs = find_connected(lat, lat.plaqs, false, &plaq_order);
+    auto connected_vols = find_connected(lat, lat.vols, false, &vol_order);
+
+    return stats_to_json(c.name(), latstats_to_json(lat), geo.sc.n_cells,
+            connected_links, connected_plaqs, connected_vols, n_dimers, false);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// CHECKS
+
+// Compares the engines one check is about; 'applies' is cleared if the
+// case is outside what they support
+typedef std::function<std::vector<field_diff>(const test_case&, bool& applies)> check_fn;
+
+std::vector<field_diff> check_layout(const test_case& c, bool& applies){
+    std::vector<field_diff> res;
+    const auto expected = implicit_stats(c);
+    supercell_index sc(c.Z);
+    for (unsigned block=1; ; block *= 2){
+        bool divides = true;
+        for (int i=0; i<3; i++) divides = divides && sc.H[i][i] % block == 0;
+        if (!divides) break;
+        std::vector<field_diff> ms;
+        diff_json(expected.stats, implicit_stats(c, block).stats, "", unless_rg_undefined(expected), ms);
+        for (auto& m : ms) m.field = "block "+std::to_string(block)+": "+m.field;
+        res.insert(res.end(), ms.begin(), ms.end());
+    }
+    applies = true;
+    return res;
+}
+
+std::vector<field_diff> check_streaming(const test_case& c, bool& applies){
+    std::vector<field_diff> res;
+    applies = c.strategy == "random" && c.lens.empty();
+    if (!applies) return res;
+
+    json found;
+    try {
+        found = streaming_stats(c);
+    } catch (const std::invalid_argument&){
+        applies = false; // too few slabs
+        return res;
+    }
+    const auto expected = implicit_stats(c);
+    diff_json(expected.stats, found, "", unless_rg_undefined(expected), res);
+    return res;
+}
+
+std::vector<field_diff> check_replicas(const test_case& c, bool& applies){
+    std::vector<field_diff> res;
+    applies = c.strategy == "random" && c.lens.empty();
+    if (!applies) return res;
+
+    const auto found = replica_stats(c);
+    for (unsigned r=0; r<n_replicas; r++){
+        auto cr = c;
+        cr.seed = c.seed + r;
+        const auto expected = implicit_stats(cr);
+        std::vector<field_diff> ms;
+        diff_json(expected.stats, found[r], "", unless_rg_undefined(expected), ms);
+        for (auto& m : ms) m.field = "replica "+std::to_string(r)+": "+m.field;
+        res.insert(res.end(), ms.begin(), ms.end());
+    }
+    return res;
+}
+
+std::vector<field_diff> check_reference(const test_case& c, bool& applies){
+    std::vector<field_diff> res;
+    applies = true;
+
+    auto cs = c;
+    cs.ids = reference_dilution(c);
+    cs.strategy = "specific";
+
+    const auto ref = reference_stats(cs);
+    const auto found = implicit_stats(cs);
+    diff_json(ref, found.stats, "", unless_rg_undefined(found), res);
+    return res;
+}
+
+
+/**
+ * The links deleted in case c, as a 'specific' case: the reference's own
+ * dilution for the reference check, the implicit engine's for the others.
+ * Streaming and replicas only take random dilutions, so cannot be made
+ * specific.
+ */
+bool make_specific(const std::string& check, test_case& c){
+    if (c.strategy == "specific") return true;
+    if (check == "streaming" || check == "replicas") return false;
+    if (check == "reference"){
+        c.ids = reference_dilution(c);
+    } else {
+        implicit_diamond lat(c.Z);
+        c.ids.clear();
+        for (auto l : deleted_links(lat, c.seed, c.strategy, c.p, c.ids)) c.ids.push_back(l);
+    }
+    c.strategy = "specific";
+    return true;
+}
+
+
+/**
+ * Smaller variants of c: smaller supercells and p (while the dilution is
+ * still drawn), fewer path lengths, no cascade, and fewer deleted links
+ * (once specific), larger reductions first.
+ */
+std::vector<test_case> shrink_candidates(const test_case& c, int min_L){
+    std::vector<test_case> res;
+    if (c.strategy != "specific"){
+        for (int i=0; i<3; i++){
+            for (int j=0; j<3; j++){
+                auto s = c;
+                if (i == j && c.Z(i,i) > min_L){
+                    s.Z(i,i) = c.Z(i,i) - 1;
+                } else if (i != j && c.Z(i,j) != 0){
+                    s.Z(i,j) = 0;
+                } else continue;
+                res.push_back(s);
+            }
+        }
+        if (c.p > 0.01){
+            auto s = c;
+            s.p = round_p(c.p / 2);
+            res.push_back(s);
+        }
+    }
+    if (c.cascade){
+        auto s = c;
+        s.cascade = false;
+        res.push_back(s);
+    }
+    for (size_t i=0; i<c.lens.size(); i++){
+        auto s = c;
+        s.lens.erase(s.lens.begin() + i);
+        res.push_back(s);
+    }
+    for (size_t chunk=std::max<size_t>(c.ids.size()/2, 1); chunk >= 1 && c.strategy == "specific"; chunk /= 2){
+        for (size_t start=0; start<c.ids.size(); start += chunk){
+            auto s = c;
+            s.ids.erase(s.ids.begin() + start,
+                    s.ids.begin() + std::min(start + chunk, c.ids.size()));
+            res.push_back(s);
+        }
+        if (chunk == 1) break;
+    }
+    return res;
+}
+
+
+/**
+ * Greedily replaces c by smaller cases on which 'check' still fails, first
+ * with the dilution drawn from the seed, then with its links listed and
+ * removed one chunk at a time. Stops after max_runs runs of the check.
+ */
+test_case shrink(const std::string& check, const check_fn& run, test_case c,
+        int min_L, unsigned max_runs){
+    unsigned n_runs = 0;
+    auto fails = [&](const test_case& s){
+        n_runs++;
+        bool applies;
+        try {
+            auto ms = run(s, applies);
+            return applies && has_strict(ms);
+        } catch (const std::exception&){
+            return false; // e.g. a singular supercell
+        }
+    };
+
+    for (int phase=0; phase<2; phase++){
+        if (phase == 1){
+            auto s = c;
+            if (!make_specific(check, s) || !fails(s)) break;
+            c = s;
+        }
+        bool progress = true;
+        while (progress && n_runs < max_runs){
+            progress = false;
+            for (const auto& s : shrink_candidates(c, min_L)){
+                if (n_runs >= max_runs) break;
+                if (fails(s)){
+                    c = s;
+                    progress = true;
+                    break;
+                }
+            }
+        }
+    }
+    return c;
+}
+
+
+// Prints the differences, failures first
+void print_mismatches(std::vector<field_diff> ms, size_t max_lines){
+    std::stable_partition(ms.begin(), ms.end(), [](const field_diff& m){ return m.strict; });
+    size_t n = 0;
+    for (const auto& m : ms){
+        if (n++ == max_lines){
+            printf("    ... %zu more\n", ms.size() - max_lines);
+            break;
+        }
+        printf("    %s%s: expected %s, found %s\n", m.strict ? "" : "(order-dependent) ",
+                m.field.c_str(), m.expected.dump().c_str(), m.found.dump().c_str());
+    }
+}
+
+
+// Prints the shrunk case, and the dmnd_dilute runs whose statfiles differ
+void print_reproducer(const char* prog, const std::string& check, const test_case& c){
+    printf("  reproduce with\n    %s --replay %s --check %s\n", prog, c.args().c_str(), check.c_str());
+    printf("  or compare the statfiles of\n");
+    if (check == "reference"){
+        auto cs = c;
+        make_specific(check, cs);
+        printf("    dmnd_dilute %s --engine implicit -o <dir>\n", cs.args().c_str());
+        // the same links, by their keys in the reference lattice
+        auto keys = reference_keys(cs);
+        cs.ids.assign(keys.begin(), keys.end());
+        printf("    dmnd_dilute %s -o <dir>\n", cs.args().c_str());
+        printf("  (which searches defects in key order rather than canonical order)\n");
+    } else if (check == "layout"){
+        printf("    dmnd_dilute %s --engine implicit --block <B> -o <dir>\n", c.args().c_str());
+        printf("    dmnd_dilute %s --engine implicit -o <dir>\n", c.args().c_str());
+    } else {
+        printf("    dmnd_dilute %s --engine %s -o <dir>\n", c.args().c_str(), check.c_str());
+        printf("    dmnd_dilute %s --engine implicit -o <dir>\n", c.args().c_str());
+    }
+}
+
+
+// A case drawn at random, with supercell sides between min_L and max_L
+test_case random_case(XoshiroCpp::Xoshiro256PlusPlus& gen, int min_L, int max_L){
+    test_case c;
+    std::uniform_int_distribution<int> side(min_L, max_L);
+    std::bernoulli_distribution coin(0.5);
+
+    // a Hermite normal form, half the time mixed by unimodular column
+    // operations so that Z itself is not triangular
+    for (int i=0; i<3; i++){
+        for (int j=0; j<3; j++) c.Z(i,j) = 0;
+        c.Z(i,i) = side(gen);
+    }
+    for (int i=0; i<3; i++){
+        for (int j=i+1; j<3; j++){
+            if (coin(gen)) c.Z(i,j) = std::uniform_int_distribution<int>(0, c.Z(i,i)-1)(gen);
+        }
+    }
+    if (coin(gen)){
+        std::uniform_int_distribution<int> col(0, 2);
+        for (int k=0; k<2; k++){
+            int a = col(gen), b = col(gen);
+            if (a == b) continue;
+            const int s = coin(gen) ? 1 : -1;
+            for (int i=0; i<3; i++) c.Z(i,a) += s*c.Z(i,b);
+        }
+    }
+
+    // no excision a third of the time, so streaming and replicas apply
+    if (std::bernoulli_distribution(2./3)(gen)){
+        for (int len=1; len<=6; len++){
+            if (std::bernoulli_distribution(0.4)(gen)) c.lens.push_back(len);
+        }
+        if (c.lens.empty()) c.lens.push_back(2);
+    }
+    c.cascade = !c.lens.empty() && std::bernoulli_distribution(1./3)(gen);
+
+    const char* strategies[5] = {"random", "random", "random", "Zr4", "specific"};
+    c.strategy = strategies[std::uniform_int_distribution<int>(0, 4)(gen)];
+    c.p = round_p(std::uniform_real_distribution<double>(0.01, 0.35)(gen));
+    c.seed = gen();
+    if (c.strategy == "specific"){
+        const int n_links = supercell_index(c.Z).n_cells * diamond::n_sl[1];
+        std::uniform_int_distribution<int> link(0, n_links - 1);
+        const int n = std::uniform_int_distribution<int>(1, 12)(gen);
+        for (int k=0; k<n; k++) c.ids.push_back(link(gen));
+        sort_and_remove_duplicates(c.ids);
+    }
+    return c;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// MAIN PROGRAM
+
+int main (int argc, const char *argv[]) {
+
+    argparse::ArgumentParser prog(argv[0]);
+
+    int n_cases;
+    prog.add_argument("--cases", "-c")
+        .help("Number of random cases")
+        .scan<'i', int>()
+        .default_value(100)
+        .store_into(n_cases);
+
+    std::string seed_s;
+    prog.add_argument("--seed", "-s")
+        .help("64-bit int seeding the cases drawn (hex); with --replay, the seed of the dilution")
+        .default_value(std::string("0"))
+        .store_into(seed_s);
+
+    int min_L;
+    prog.add_argument("--min_L")
+        .help("Smallest supercell side drawn, in primitive cells")
+        .scan<'i', int>()
+        .default_value(3)
+        .store_into(min_L);
+
+    int max_L;
+    prog.add_argument("--max_L")
+        .help("Largest supercell side drawn, in primitive cells")
+        .scan<'i', int>()
+        .default_value(5)
+        .store_into(max_L);
+
+    std::vector<std::string> checks;
+    prog.add_argument("--check")
+        .help("Checks to run")
+        .nargs(argparse::nargs_pattern::at_least_one)
+        .default_value<std::vector<std::string>>({"layout", "streaming", "replicas", "reference"})
+        .store_into(checks);
+
+    int max_shrink;
+    prog.add_argument("--max_shrink")
+        .help("Most runs of a check spent shrinking one failure; 0 disables shrinking")
+        .scan<'i', int>()
+        .default_value(2000)
+        .store_into(max_shrink);
+
+    prog.add_argument("--verbose", "-v")
+        .help("Print every case")
+        .default_value(false)
+        .implicit_value(true);
+
+    // A single case, as printed for a shrunk failure
+    std::vector<int> replay;
+    prog.add_argument("--replay")
+        .help("Run only the case on this supercell (Z1 Z2 Z3, as dmnd_dilute), "
+              "with the dilution and excision given by the options below")
+        .nargs(9)
+        .scan<'i', int>()
+        .store_into(replay);
+
+    std::vector<int> neighbours;
+    prog.add_argument("--neighbours", "-n")
+        .scan<'i', int>()
+        .nargs(argparse::nargs_pattern::at_least_one)
+        .store_into(neighbours);
+
+    prog.add_argument("--cascade")
+        .default_value(false)
+        .implicit_value(true);
+
+    prog.add_argument("--dilution_strategy", "-y")
+        .choices("random", "Zr4", "specific")
+        .default_value("random");
+
+    double dilution_prob = 0;
+    prog.add_argument("--dilution_prob", "-p")
+        .scan<'g', double>()
+        .store_into(dilution_prob);
+
+    std::vector<int> spin_ids_to_delete;
+    prog.add_argument("--delete_spins", "-d")
+        .help("Canonical link ids, as the implicit engine takes them")
+        .default_value<std::vector<int>>({})
+        .nargs(argparse::nargs_pattern::at_least_one)
+        .scan<'i', int>()
+        .store_into(spin_ids_to_delete);
+
+    try {
+        prog.parse_args(argc, argv);
+    } catch (const std::exception& err){
+        cerr << err.what() << endl;
+        cerr << prog;
+        std::exit(1);
+    }
+
+    uint64_t seed;
+    std::stringstream ss;
+    ss << std::hex << seed_s;
+    ss >> seed;
+
+    if (min_L < 1 || max_L < min_L){
+        throw std::invalid_argument("Need 1 <= min_L <= max_L");
+    }
+
+    const std::map<std::string, check_fn> all_checks = {
+        {"layout", check_layout},
+        {"streaming", check_streaming},
+        {"replicas", check_replicas},
+        {"reference", check_reference}
+    };
+    for (const auto& name : checks){
+        if (!all_checks.contains(name)){
+            throw std::invalid_argument("Unknown check "+name);
+        }
+    }
+
+    std::vector<test_case> cases;
+    if (prog.is_used("--replay")){
+        test_case c;
+        for (int j=0; j<3; j++){
+            for (int i=0; i<3; i++) c.Z(i,j) = replay[3*j + i];
+        }
+        c.lens = search_lengths(neighbours);
+        c.cascade = prog.get<bool>("--cascade");
+        c.strategy = prog.get<std::string>("--dilution_strategy");
+        c.p = dilution_prob;
+        c.seed = seed;
+        c.ids = spin_ids_to_delete;
+        sort_and_remove_duplicates(c.ids);
+        cases.push_back(c);
+    } else {
+        XoshiroCpp::Xoshiro256PlusPlus gen(seed);
+        for (int k=0; k<n_cases; k++) cases.push_back(random_case(gen, min_L, max_L));
+    }
+
+    // per check: cases run, strict failures, order-dependent differences only
+    std::map<std::string, std::array<unsigned, 3>> tally;
+    std::set<std::string> shrunk;
+    for (size_t k=0; k<cases.size(); k++){
+        const auto& c = cases[k];
+        if (prog.get<bool>("--verbose")){
+            printf("[case %zu] %s\n", k, c.args().c_str());
+        }
+        for (const auto& name : checks){
+            bool applies = false;
+            std::vector<field_diff> ms;
+            try {
+                ms = all_checks.at(name)(c, applies);
+            } catch (const std::exception& err){
+                applies = true;
+                ms.push_back({"exception", json(), err.what(), true});
+            }
+            if (!applies) continue;
+            tally[name][0]++;
+            if (ms.empty()) continue;
+            if (!has_strict(ms)){
+                tally[name][2]++;
+                continue;
+            }
+
+            tally[name][1]++;
+            printf("[%s] FAILED on case %zu: %s\n", name.c_str(), k, c.args().c_str());
+            print_mismatches(ms, 10);
+            if (max_shrink > 0 && !shrunk.contains(name) && ms.front().field != "exception"){
+                shrunk.insert(name);
+                auto s = shrink(name, all_checks.at(name), c, min_L, max_shrink);
+                bool ignored;
+                printf("  shrunk to %s\n", s.args().c_str());
+                print_mismatches(all_checks.at(name)(s, ignored), 10);
+                print_reproducer(argv[0], name, s);
+            }
+        }
+    }
+
+    bool ok = true;
+    for (const auto& name : checks){
+        const auto& t = tally[name];
+        printf("[crosscheck] %-9s %5u cases, %u failed, %u with order-dependent differences only\n",
+                name.c_str(), t[0], t[1], t[2]);
+        ok = ok && t[1] == 0;
+    }
+    return ok ? 0 : 1;
+}
@@ -1,12 +1,14 @@
 #include <cassert>
+#include <cmath>
 #include <argparse.hpp>
 #include <cstdio>
 #include <filesystem>
 #include <iostream>
 #include <lattice_IO.hpp>
+#include <memory_resource>
+#include <optional>
 #include <ostream>
 #include <algorithm>
-#include <queue>
 #include <random>
 #include <sstream>
 #include <stdexcept>
@@ -21,8 +23,21 @@
 #include <preset_cellspecs.hpp>
 #include <UnitCellSpecifier.hpp>
 
+#include "arena.hpp"
+#include "cell_set.hpp"
+#include "cluster_labels.hpp"
+#include "dilution.hpp"
 #include "format_bits.hpp"
 #include "geom_traverser.hpp"
+#include "implicit_diamond.hpp"
+#include "implicit_pipeline.hpp"
+#include "perf_counters.hpp"
+#include "reference_pipeline.hpp"
+#include "replica_percolation.hpp"
+#include "run_key.hpp"
+#include "slab_stream.hpp"
+#include "stats_json.hpp"
+#include "work_counters.hpp"
 /**
  * Adds link disorder to a diaomnd lattice and removes any 
  * even length intermediaries.
@@ -33,133 +48,6 @@ using namespace nlohmann;
 using namespace std;
 
 
-struct Tetra : public Cell<0> {
-};
-
-struct Spin : public Cell<1> {
-    //bool visited = false;
-    Tetra* origin = nullptr;
-    const Spin* root = nullptr;
-};
-
-struct Plaq : public Cell<2> {
-//    bool visited = false;
-    const Plaq* root = nullptr;
-};
-
-struct Vol : public Cell<3> {
- //   bool visited = false;
-    const Vol* root = nullptr;
-};
-
-typedef PeriodicVolLattice<Tetra, Spin, Plaq, Vol> Lattice;
-
-
-struct search_node {
-    const Cell<0>* point;
-    Chain<1> path;
-};
-
-
-void excise_path(Lattice& lat, Chain<1>& path, std::set<void*>& deleted_link_ptrs, std::vector<ipos_t>& deleted_link_locs){
-    for (auto [l, _] : path){
-        auto s = static_cast<Spin*>(l);
-        //if (lat.has_link(s)){
-        if (!deleted_link_ptrs.contains(s)){
-//            assert(lat.has_link(s));
-            deleted_link_locs.push_back(s->position);
-            lat.erase_link(s);
-            deleted_link_ptrs.insert(s);
-        }
-    }
-}
-
-inline std::vector<Chain<1>> find_defect_links(
-        Tetra* origin, unsigned len ){
-    /** 
-     * Finds all paths of specified length(s) connecting origin to a 
-     * defect node and removes them from the lattice
-     * @param lat: the base lattice
-     * @param origin: the starting point
-     * @param lens_to_trim: the set of lattice-seps to delete 
-     * measured as the number of Tetras that are part of the path
-     * EXCLUDING start (len=1 correspnds to nearest-neighbour pyrochlore sites)
-     */
-
-    /*
-    // ensure nothing is visited
-    for (auto& l : lat.get_links()){
-        //l.visited = false;
-    }
-    */
-
-    std::queue<search_node> to_visit;
-    to_visit.push(search_node(origin, Chain<1>()));
-
-    std::vector<Chain<1>> res;
-    while (!to_visit.empty()){
-        auto& curr = to_visit.front();
-
-        // Check if we are at another defect point
-        if (curr.path.size() == len){
-            if (curr.point->coboundary.size() < 4){
-                // trimmable path: mark it for deletion
-                cleanup_chain(curr.path);
-                res.push_back(curr.path);
-            }
-            to_visit.pop(); // curr invalidated!
-            continue;
-        }
-
-        assert (curr.path.size() < len);
-#ifdef DEBUG
-        cout<<curr.point->position<<"\t| "<< curr.path.size() <<"     \t| "<< d(curr.path)<<"\n";
-#endif
-        for (const auto& [l, m] : curr.point->coboundary){
-            Spin* ln = static_cast<Spin*>(l);
-            if (ln->origin == origin) continue;
-            ln->origin = origin;
-            Chain<1> this_ln; this_ln[l]=m;
-            for (auto [p2, n] : d(this_ln)){
-                if (p2 != curr.point){ 
-                    to_visit.push(search_node(p2,curr.path + this_ln));
-                }
-            }
-        }
-        to_visit.pop();
-    }
-
-    return res;
-}
-
-
-
-
-// Deletes specified spin ids from the lattice
-// Returns a std::set of Point* of 3 or less-member tetras
-// I don't remember why I didn't just use a std::set for the spins...
-// Presumably it was a good reason??
-void del_spins_get_dtetras(Lattice& lat, std::set<Spin*>& spins_to_delete, std::set<Tetra*>& defect_pts){
-    std::unordered_set<Spin*> present_spins;
-    for (const auto& [_, l] : lat.links){
-        present_spins.insert(l);
-    }
-    // make sure it's in order
-    // delete the spins
-    for (auto s : spins_to_delete){
-        auto l = s;
-        //if (!lat.has_link(l)){
-        if (!present_spins.contains(l)){
-            throw std::out_of_range("Tried to delete spins at nonexistent index");
-        }
-        for (const auto& [p, _] : l->boundary){
-            defect_pts.insert(static_cast<Tetra*>(p));
-        }
-        lat.erase_link(l);
-        present_spins.erase(l);
-    }
-}
-
 /////////////////////////////////
 /// EXPORTING TO FILE ///////////
 
@@ -185,245 +73,412 @@ void export_lattice(
 }
 
 
-inline json latstats_to_json(const Lattice& lat){
-    json counts = {};
-    counts["points"] = lat.points.size();
-    counts["links"] = lat.links.size();
-    counts["plaqs"] = lat.plaqs.size();
-    counts["vols"] = lat.vols.size();
+// Only the statistics 'sel' selects; with 'work', also the work counters of
+// the run if they are compiled in (see work_counters.hpp)
+template <typename CL, typename CP, typename CV>
+void export_stats(
+        const filesystem::path& path,
+        const std::string& name,
+        const json& counts,
+        uint64_t n_prim_cells,
+        const std::vector<CL>& connected_links,
+        const std::vector<CP>& connected_plaqs,
+        const std::vector<CV>& connected_vols,
+        const std::vector<std::map<size_t, size_t>>& n_dimers,
+        const stats_selection& sel,
+        bool work=false
+        ){
+    cout<<"Saving statistics to \n"<<path<<std::endl;
+
+    auto j = stats_to_json(name, counts, n_prim_cells,
+            connected_links, connected_plaqs, connected_vols, n_dimers, true, sel);
+#ifdef DMND_WORK_COUNTERS
+    if (work) j["work"] = work_counters::to_json(work_counters::current());
+#else
+    (void)work;
+#endif
 
-    return counts;
+    std::ofstream of(path); 
+    of << j;
+    of.close();
 }
 
-// returns a set of sizes of the conn_components, sorted low to high
-template <typename T>
-inline std::vector<size_t> get_sorted_sizes(const std::vector<conn_components<T>>& parts ){
-    std::vector<size_t> size_set;
-    for (const auto& p : parts){
-        auto size = p.elems.size();
-        auto it = std::lower_bound(size_set.begin(), size_set.end(), size);
-        size_set.insert(it, size);
+
+// Names the realisation and draws its links, see deleted_links
+void determine_deleted_links(
+        std::stringstream& name,
+        std::vector<uint32_t>& links_to_yeet,
+        const implicit_diamond& lat, uint64_t seed,
+        const std::string& erase_strat,
+        double dilution_prob,
+        std::vector<int>& spin_ids_to_delete
+        ){
+    char buf[1024];
+
+    if (erase_strat == "random"){
+        snprintf(buf, 1024, "p=%.04f;seed=%llx;", dilution_prob, (unsigned long long)seed);
+        name << buf;
+    } else if (erase_strat == "Zr4") {
+        snprintf(buf, 1024, "pZr=%.04f;seed=%llx;", dilution_prob/2, (unsigned long long)seed);
+        name << buf;
+    } else if (erase_strat == "specific"){
+        if (spin_ids_to_delete.size() > 0){
+            std::cout << "Erasing SPECIFIC spins\n";
+            sort_and_remove_duplicates(spin_ids_to_delete);
+            name << comma_separate("d1", spin_ids_to_delete);
+        }
     }
-    return size_set;
+
+    links_to_yeet = deleted_links(lat, seed, erase_strat, dilution_prob, spin_ids_to_delete);
 }
 
-template <typename T>
-inline std::map<size_t, size_t>
-size_histogram(const std::vector<conn_components<T>>& parts){
-    std::map<size_t, size_t> hist;
-    for (const auto&p : parts){
-        auto size = p.elems.size();
-        if (hist.find(size) == hist.end()) {
-          hist[size] = 1;
-        } else {
-          hist[size]++;
+
+// Checks whether the outputs exist, and aborts unless forced. The paths are
+// derived from the run's key, so this never lists or reads the manifest.
+void check_outputs(const filesystem::path& statpath, const filesystem::path& latpath,
+        bool save_lattice, bool force){
+    if (!force){
+        // Check if these files already exist, if so abort early
+        if ( !save_lattice && filesystem::exists(statpath)){
+            cerr << "Statfile " << statpath << "already exists" << std::endl;
+            throw std::runtime_error("Statfile exists");
+        }
+        if ( save_lattice && filesystem::exists(latpath)){
+            cerr << "latfile " << latpath << "already exists" << std::endl;
+            throw std::runtime_error("Latfile exists");
         }
     }
-    return hist;
 }
 
 
-template <typename T>
-inline std::pair<bool, std::vector<ipos_t>> test_wraps(const std::vector<conn_components<T>>& parts ){
-    std::vector<ipos_t> wrapping_cluster;
-    bool wraps = false;
-    for (const auto& p : parts){
-        if (p.wraps) { 
-            wraps = true;
-            for (auto x : p.elems) {
-                wrapping_cluster.push_back(x->position);
-            }
-            break;
+/**
+ * The whole pipeline on the implicit lattice: dilution, defect excision in
+ * the same order as main() uses, and the cluster statistics 'sel' selects;
+ * 'stage' reports each step. Plaqs and vols are not even derived from the
+ * links unless selected.
+ */
+void run_implicit(
+        std::stringstream& name,
+        const filesystem::path& outpath,
+        const imat33_t& supercell_spec,
+        const std::vector<int>& neighbours,
+        uint64_t seed,
+        const std::string& erase_strat,
+        double dilution_prob,
+        std::vector<int>& spin_ids_to_delete,
+        bool cascade,
+        unsigned block,
+        bool save_labels,
+        bool force,
+        const stats_selection& sel,
+        arena::stage_timer& stage
+        ){
+    work_counters::reset();
+    implicit_diamond lat(supercell_spec, block);
+    stage("construct");
+
+    std::vector<uint32_t> links_to_yeet;
+    determine_deleted_links(name, links_to_yeet, lat, seed, erase_strat,
+            dilution_prob, spin_ids_to_delete);
+    stage("dilute", lat.size(1));
+
+    auto statpath = run_key::output_path(outpath, name.str(), ".stats.json");
+    check_outputs(statpath, run_key::output_path(outpath, name.str(), ".lat.json"), false, force);
+    std::vector<filesystem::path> outputs = {statpath};
+
+    size_t n_visited = 0;
+    auto n_dimers = dilute_and_excise(lat, links_to_yeet,
+            search_lengths(neighbours), cascade, true, &n_visited, sel.faces());
+    stage("excise", n_visited);
+
+    // labels are overwritten by each search, so they are saved in between;
+    // a search for the wrapping flag alone leaves them incomplete
+    auto labelpath = [&](const char* dim){
+        outputs.push_back(run_key::output_path(outpath, name.str(),
+                    std::string(".")+dim+"_labels.bin"));
+        return outputs.back();
+    };
+    std::vector<cluster_summary> connected_links, connected_plaqs, connected_vols;
+    if (sel.computes(1)){
+        connected_links = find_connected<1>(lat, !sel.is_full(1));
+        if (save_labels && sel.is_full(1)){
+            cluster_labels::write_file<1>(labelpath("link"), lat, supercell_spec, connected_links);
+        }
+    }
+    if (sel.computes(2)){
+        connected_plaqs = find_connected<2>(lat, !sel.is_full(2));
+        if (save_labels && sel.is_full(2)){
+            cluster_labels::write_file<2>(labelpath("plaq"), lat, supercell_spec, connected_plaqs);
         }
     }
-    return std::make_pair(wraps, wrapping_cluster);
+    if (sel.computes(3)){
+        connected_vols = find_connected<3>(lat, !sel.is_full(3));
+        if (save_labels && sel.is_full(3)){
+            cluster_labels::write_file<3>(labelpath("vol"), lat, supercell_spec, connected_vols);
+        }
+    }
+    stage("clusters", total_size(connected_links) + total_size(connected_plaqs)
+            + total_size(connected_vols));
+
+    export_stats(statpath, name.str(), latstats_to_json(lat), lat.sc.n_cells,
+            connected_links, connected_plaqs, connected_vols,
+            n_dimers, sel, true);
+    run_key::record(outpath, name.str(), outputs);
+    stage("export");
 }
 
 
-inline json percolstats_to_json(
-        const std::vector<conn_components<Spin>> connected_links,
-        const std::vector<conn_components<Plaq>> connected_plaqs,
-        const std::vector<conn_components<Vol>> connected_vols
-        ) {
+/**
+ * Percolation statistics without ever holding the lattice in memory, see
+ * slab_stream.hpp. Only random dilution is possible, and since excision
+ * is nonlocal no defect paths are removed. Dimensions 'sel' leaves out are
+ * skipped; a wrapping flag alone costs the whole search all the same.
+ */
+void run_streaming(
+        std::stringstream& name,
+        const filesystem::path& outpath,
+        const imat33_t& supercell_spec,
+        const std::vector<int>& neighbours,
+        uint64_t seed,
+        const std::string& erase_strat,
+        double dilution_prob,
+        bool force,
+        const stats_selection& sel
+        ){
+    if (erase_strat != "random"){
+        throw std::logic_error("Streaming supports only the random dilution strategy");
+    }
+    if (!neighbours.empty()){
+        throw std::logic_error("Streaming cannot excise defect paths, drop --neighbours");
+    }
 
-    json percolstats = {};
+    diamond_geometry geo(supercell_spec);
 
-    percolstats["n_link_parts"] = connected_links.size();
-    percolstats["link_cluster_dist"] = size_histogram(connected_links);
-    auto tmp_link = test_wraps(connected_links);
-    percolstats["links_wrap"] = tmp_link.first;
+    char buf[1024];
+    snprintf(buf, 1024, "p=%.04f;seed=%llx;", dilution_prob, (unsigned long long)seed);
+    name << buf;
 
-    // percolstats["link_wrapping_cluster"] = tmp_link.second;
-    percolstats["n_plaq_parts"] = connected_plaqs.size();
-    percolstats["plaq_cluster_dist"] = size_histogram(connected_plaqs);
-    auto tmp_plaq = test_wraps(connected_plaqs);
-    percolstats["plaqs_wrap"] = tmp_plaq.first;
+    auto statpath = run_key::output_path(outpath, name.str(), ".stats.json");
+    check_outputs(statpath, run_key::output_path(outpath, name.str(), ".lat.json"), false, force);
 
-    percolstats["n_vol_parts"] = connected_vols.size();
-    percolstats["vol_cluster_dist"] = size_histogram(connected_vols);
-    auto tmp_vol = test_wraps(connected_vols);
-    percolstats["vols_wrap"] = tmp_vol.first;
+    streamed_dilution dil{geo, seed, dilution_prob};
 
-    cout<< "Links wrap: " << percolstats["links_wrap"] <<"\n";
-    cout<< "Plaqs wrap: " << percolstats["plaqs_wrap"] <<"\n";
-    cout<< "Vols wrap: " << percolstats["vols_wrap"] <<"\n";
+    json counts = {};
+    uint64_t n_alive;
+    counts["points"] = geo.size(0);
+    std::vector<cluster_summary> connected_links, connected_plaqs, connected_vols;
+    if (sel.computes(1)){
+        connected_links = find_connected_streaming<1>(dil, n_alive);
+        counts["links"] = n_alive;
+    }
+    if (sel.computes(2)){
+        connected_plaqs = find_connected_streaming<2>(dil, n_alive);
+        counts["plaqs"] = n_alive;
+    }
+    if (sel.computes(3)){
+        connected_vols = find_connected_streaming<3>(dil, n_alive);
+        counts["vols"] = n_alive;
+    }
 
-    return percolstats;
+    export_stats(statpath, name.str(), counts, geo.sc.n_cells,
+            connected_links, connected_plaqs, connected_vols,
+            std::vector<std::map<size_t, size_t>>(), sel);
+    run_key::record(outpath, name.str(), {statpath});
 }
 
 
-
-void export_stats(
-        const filesystem::path& path,
-        const Lattice& lat,
-        const std::vector<conn_components<Spin>> connected_links,
-        const std::vector<conn_components<Plaq>> connected_plaqs,
-        const std::vector<conn_components<Vol>> connected_vols,
-        const std::map<size_t, size_t>& n_dimers
+/**
+ * Percolation statistics of the 64 random dilutions with seeds
+ * seed..seed+63 at once, see replica_percolation.hpp. Writes one statfile
+ * per seed, the same as the implicit engine writes for that seed. The plaq
+ * and vol masks are only built if 'sel' needs them.
+ */
+void run_replicas(
+        const std::stringstream& name,
+        const filesystem::path& outpath,
+        const imat33_t& supercell_spec,
+        const std::vector<int>& neighbours,
+        uint64_t seed,
+        const std::string& erase_strat,
+        double dilution_prob,
+        bool force,
+        const stats_selection& sel
         ){
-    cout<<"Saving statistics to \n"<<path<<std::endl;
-
-
-    json j = {};
-
-    j["__version__"] = 2;
-    j["counts"] = latstats_to_json(lat);
-    j["percolation"] = percolstats_to_json(connected_links, connected_plaqs, connected_vols);
+    if (erase_strat != "random"){
+        throw std::logic_error("Replicas support only the random dilution strategy");
+    }
+    if (!neighbours.empty()){
+        throw std::logic_error("Replicas cannot excise defect paths, drop --neighbours");
+    }
 
-    j["n_dimers"] = {};
-    for (auto& [n, c] : n_dimers){
-        j["n_dimers"][std::to_string(n)] = c;
-        cout << n <<"-dimers: " << c <<"\n";
+    diamond_geometry geo(supercell_spec);
+
+    std::vector<std::string> names;
+    std::vector<filesystem::path> statpaths;
+    for (unsigned r=0; r<n_replicas; r++){
+        char buf[1024];
+        snprintf(buf, 1024, "p=%.04f;seed=%llx;", dilution_prob, (unsigned long long)(seed + r));
+        names.push_back(name.str()+buf);
+        statpaths.push_back(run_key::output_path(outpath, names.back(), ".stats.json"));
+        check_outputs(statpaths.back(),
+                run_key::output_path(outpath, names.back(), ".lat.json"), false, force);
     }
 
-    std::ofstream of(path); 
-    of << j;
-    of.close();
+    replica_dilution dil(geo, seed, dilution_prob,
+            sel.computes(3) ? 3 : sel.computes(2) ? 2 : 1);
+    replica_clusters connected_links, connected_plaqs, connected_vols;
+    if (sel.computes(1)) connected_links = find_connected_replicas<1>(dil);
+    if (sel.computes(2)) connected_plaqs = find_connected_replicas<2>(dil);
+    if (sel.computes(3)) connected_vols = find_connected_replicas<3>(dil);
+
+    for (unsigned r=0; r<n_replicas; r++){
+        json counts = {};
+        counts["points"] = geo.size(0);
+        counts["links"] = connected_links.n_alive[r];
+        counts["plaqs"] = connected_plaqs.n_alive[r];
+        counts["vols"] = connected_vols.n_alive[r];
+
+        export_stats(statpaths[r], names[r], counts, geo.sc.n_cells,
+                connected_links.clusters[r], connected_plaqs.clusters[r],
+                connected_vols.clusters[r],
+                std::vector<std::map<size_t, size_t>>(), sel);
+        run_key::record(outpath, names[r], {statpaths[r]});
+    }
 }
 
 
-void sort_and_remove_duplicates(std::vector<int>& v){
-    // Sort all of these so we don't muck up any indexing
-    std::sort(v.begin(), v.end());
-    // silently remove any duplicates
-    v.erase( unique( v.begin(), v.end() ), v.end() );
-}
-
 
-static const ipos_t pyro_r[4] = {
-    {1,1,1},
-    {1,-1,-1},
-    {-1,1,-1},
-    {-1,-1,1}
-};
-
-
-static const std::vector<std::array<int ,4>> mu_set = {
-    {0,1,2,3},
-    {0,1,3,2},
-    {0,2,1,3},
-    {0,2,3,1},
-    {0,3,1,2},
-    {0,3,2,1},
-    {1,0,2,3},
-    {1,0,3,2},
-    {1,2,0,3},
-    {1,2,3,0},
-    {1,3,0,2},
-    {1,3,2,0},
-    {2,0,1,3},
-    {2,0,3,1},
-    {2,1,0,3},
-    {2,1,3,0},
-    {2,3,0,1},
-    {2,3,1,0},
-    {3,0,1,2},
-    {3,0,2,1},
-    {3,1,0,2},
-    {3,1,2,0},
-    {3,2,0,1},
-    {3,2,1,0}
-};
-
-
-void determine_deleted_spins(
+/**
+ * The pipeline on latticelab's PeriodicVolLattice: dilution, defect
+ * excision (repeated over the new defects with 'cascade') and the cluster
+ * statistics 'sel' selects. latticelab builds the plaqs and vols whatever
+ * 'sel' says, but they are only searched if selected. Containers are
+ * std::pmr, so they allocate from whatever arena is installed; 'stage'
+ * reports the time and allocations of each step.
+ */
+void run_reference(
         std::stringstream& name,
-        std::set<Spin*>& spins_to_yeet,
-        Lattice& lat, uint64_t seed,
+        const filesystem::path& outpath,
+        const imat33_t& supercell_spec,
+        const std::vector<int>& neighbours,
+        uint64_t seed,
         const std::string& erase_strat,
         double dilution_prob,
-        std::vector<int>& spin_ids_to_delete
+        std::vector<int>& spin_ids_to_delete,
+        bool cascade,
+        bool save_lattice,
+        bool force,
+        int verbosity,
+        const stats_selection& sel,
+        arena::stage_timer& stage
         ){
+    work_counters::reset();
+    const auto spec = PrimitiveSpecifiers::DiamondSpec();
+    Lattice lat(spec, supercell_spec);
+    index_cells(lat.points);
+    index_cells(lat.links);
+    stage("construct", lat.points.size() + lat.links.size() + lat.plaqs.size()
+            + lat.vols.size());
 
-    XoshiroCpp::Xoshiro256PlusPlus gen(seed);
-    char buf[1024];
+    cell_set<Spin> spins_to_yeet;
 
-    if (erase_strat == "random"){
-        // Erase spins with probability p
-        std::bernoulli_distribution d1(dilution_prob);
-        for (const auto& [_, p] : lat.links) {
-            if (d1(gen)) spins_to_yeet.insert(p);
-        }
-        snprintf(buf, 1024, "p=%.04f;seed=%llx;", dilution_prob, seed);
-        name << buf;
-    } else if (erase_strat == "Zr4") {
-        // Erase spins coordinated with a dual-tetrahedron (motivated by O2- in center of the Zr4+)
-        std::bernoulli_distribution d_O2(dilution_prob/2);
-//        std::uniform_int_distribution<size_t> d_first_site(0,11);
-        std::vector<Vol*> stuffed_dual_tetras;
-        // decide where the O2 goes
-        for (const auto& [_, v] : lat.vols) {
-            if (d_O2(gen)) stuffed_dual_tetras.push_back(v);
+    determine_deleted_spins(name, spins_to_yeet, lat, seed, erase_strat, dilution_prob, spin_ids_to_delete);
+    stage("dilute", lat.links.size());
+
+
+    if (verbosity >= 4 ){
+        cout << "Deleting spins at:\n";
+        for (auto s: spins_to_yeet) {
+            cout << s->position << "\n";
         }
+    }
 
-        auto _mu_set = mu_set;
 
-        // ... and kill two of the links.
-        for (const auto& v : stuffed_dual_tetras){
-            const auto& R0 = v->position;
-            auto vol_sl = lat.primitive_spec.sl_of_vol(R0);
+    // Name now fully specified
+    auto statpath = run_key::output_path(outpath, name.str(), ".stats.json");
+    auto latpath = run_key::output_path(outpath, name.str(), ".lat.json");
 
-            // choose this by jumping randomly to one of 4 nn
-            // direct-lattice tetrahedra, then choosing a random sl
+    check_outputs(statpath, latpath, save_lattice, force);
 
+    // Record the positions of the directly-diluted spins before they are
+    // erased from the lattice (their pointers are invalidated by deletion).
+    std::vector<ipos_t> deleted_spin_locs;
+    for (const auto s : spins_to_yeet){
+        deleted_spin_locs.push_back(s->position);
+    }
+
+    cell_set<Tetra> defect_tetras;
+    del_spins_get_dtetras(lat, spins_to_yeet, defect_tetras);
+    stage("erase", spins_to_yeet.size());
+
+    lat.print_state(verbosity);
+
+      
     
-            // observation: 1. spins lying on all sl=0 cages can be written as
-            // void_center +/- ( 2*pyro_r[mu] + pyro_r[nu]) (- for sl=1 case)
-            // obs. 2: second-neighbours (supporting singlets) are exactly the cases where 
-            // mu1, nu1, mu2, nu2 are all distinct.
-            
-            std::shuffle(_mu_set.begin(), _mu_set.end(), gen);
-
-            Spin* s1;
-            Spin* s2;
-            for (int i=0; i<24; i++){
-                auto& mu = _mu_set[i];
-                const auto& R1 = R0 - (1 - 2*vol_sl) * ( 2* pyro_r[mu[0]] + pyro_r[mu[1]]);
-                const auto& R2 = R0 - (1 - 2*vol_sl) * ( 2* pyro_r[mu[2]] + pyro_r[mu[3]]);          
-                s1 = &lat.get_link_at(R1);
-                s2 = &lat.get_link_at(R2);
-
-                if (!(spins_to_yeet.contains(s1) || spins_to_yeet.contains(s2))){
-                    spins_to_yeet.insert(s1);
-                    spins_to_yeet.insert(s2);
-                    break;
-                }
-            } 
+    if (verbosity >= 3){
+        // sanity check: ensure all tetras are really defective
+        std::cout<<"Defect tetras:\n";
+        for (const auto t : defect_tetras){
+            assert(t->coboundary.size() < 4);
+            std::cout<<"[Dtetra] "<<t->position<<"\n";
         }
+    }
+
+    if (verbosity >= 1){
+        std::cout<<"\n Finding links...\n";
+    }
+
+    // note that link erasures are guaranteed not to delete any points.
+    vector<Tetra*> defect_tetras_vec(defect_tetras.begin(), defect_tetras.end());
+
+    std::vector<ipos_t> deleted_link_locs;
+
+    // initialise the spins to have nullptr roots
+    for (const auto& [_, s] : lat.links){
+        s->origin = nullptr;
+    }
     
-        snprintf(buf, 1024, "pZr=%.04f;seed=%llx;", dilution_prob/2, seed);
-        name << buf;
-    } else if (erase_strat == "specific"){
-        // Erase the specified spins
-        if (spin_ids_to_delete.size() > 0){
-            std::cout << "Erasing SPECIFIC spins\n";
-            sort_and_remove_duplicates(spin_ids_to_delete);
-            for (auto& x : spin_ids_to_delete){
-                spins_to_yeet.insert(lat.links.at(x));
-            }
-            name << comma_separate("d1", spin_ids_to_delete);
+    // path counts of each generation of the cascade
+    std::vector<std::map<size_t, size_t>> n_dimers;
+
+    auto lens = search_lengths(neighbours);
+    cell_set<Spin> deleted_links;
+    size_t n_visited = 0;
+    auto worklist = defect_tetras_vec;
+    do {
+        if (!n_dimers.empty()){
+            printf("[cascade] generation %zu: %zu new defects\n", n_dimers.size(), worklist.size());
         }
-    } else { throw std::logic_error("bad dilution strategy"); }
+        n_dimers.emplace_back();
+        worklist = excise_defect_paths(lat, worklist, lens,
+                deleted_links, deleted_link_locs, n_dimers.back(), true, &n_visited);
+    } while (cascade && !worklist.empty());
+    stage("excise", n_visited);
+
+    if (save_lattice){
+        export_lattice(latpath, lat, deleted_spin_locs, deleted_link_locs);
+    }
+
+    // Counting complete. 
+    // Finding connected components:
+
+    std::vector<conn_components<Spin>> connected_links;
+    std::vector<conn_components<Plaq>> connected_plaqs;
+    std::vector<conn_components<Vol>> connected_vols;
+    if (sel.computes(1)) connected_links = find_connected(lat, lat.links, !sel.is_full(1));
+    if (sel.computes(2)) connected_plaqs = find_connected(lat, lat.plaqs, !sel.is_full(2));
+    if (sel.computes(3)) connected_vols = find_connected(lat, lat.vols, !sel.is_full(3));
+    stage("clusters", total_size(connected_links) + total_size(connected_plaqs)
+            + total_size(connected_vols));
+
+    export_stats(statpath, name.str(), latstats_to_json(lat),
+            supercell_index(supercell_spec).n_cells,
+            connected_links, connected_plaqs, connected_vols,
+            n_dimers, sel, true);
+    std::vector<filesystem::path> outputs = {statpath};
+    if (save_lattice) outputs.push_back(latpath);
+    run_key::record(outpath, name.str(), outputs);
+    stage("export");
 }
 
 
@@ -496,6 +551,53 @@ int main (int argc, const char *argv[]) {
     prog.add_argument("--dilution_strategy", "-y")
         .choices("random", "Zr4", "specific")
         .default_value("random");
+
+    prog.add_argument("--cascade")
+        .help("Keep searching from the defects each round of excisions creates, until there are none")
+        .default_value(false)
+        .implicit_value(true);
+
+    prog.add_argument("--engine")
+        .help("'implicit' computes adjacency on the fly instead of storing it, "
+              "'streaming' also never stores the dilution (random strategy only), "
+              "'replicas' runs seeds seed..seed+63 at once (random strategy only)")
+        .choices("reference", "implicit", "streaming", "replicas")
+        .default_value("reference");
+
+    prog.add_argument("--arena")
+        .help("Where the reference engine's containers allocate: 'none' (the heap), "
+              "'monotonic' (one per-realisation arena) or 'huge' (the same, on huge pages)")
+        .choices("none", "monotonic", "huge")
+        .default_value("none");
+
+    int block;
+    prog.add_argument("--block")
+        .help("Lay out the implicit lattice in tiles of block^3 primitive cells "
+              "(a power of two dividing the supercell's HNF diagonal); 0 is row-major")
+        .scan<'i', int>()
+        .default_value(0)
+        .store_into(block);
+
+    prog.add_argument("--save_labels")
+        .help("Also write each cell's cluster label and a table of the clusters, "
+              "as raw binary next to the statfile (implicit engine only)")
+        .default_value(false)
+        .implicit_value(true);
+
+    std::string stats_spec;
+    prog.add_argument("--stats")
+        .help("Cluster statistics to compute, as a comma-separated list of links, plaqs "
+              "and vols; links_wrap etc. compute only whether some cluster wraps, "
+              "stopping at the first that does")
+        .default_value(std::string("links,plaqs,vols"))
+        .store_into(stats_spec);
+
+    prog.add_argument("--perf")
+        .help("Report cycles, instructions, IPC and LLC and branch misses per cell "
+              "visited of each stage, from hardware counters where the kernel allows "
+              "(reference and implicit engines)")
+        .default_value(false)
+        .implicit_value(true);
     
 
     try {
@@ -529,130 +631,77 @@ int main (int argc, const char *argv[]) {
     name << parse_supercell_spec(supercell_spec, prog);
     std::cout<<"Constructing supercell of dimensions \n"<<supercell_spec<<std::endl;
 
-    const auto spec = PrimitiveSpecifiers::DiamondSpec();
- 
-    name << comma_separate("nn", neighbours);
-
+    // sorted, so that "-n 4 2" and "-n 2 4" share a key
+    name << comma_separate("nn", search_lengths(neighbours));
 
-    Lattice lat(spec, supercell_spec);
+    bool cascade = prog.get<bool>("--cascade");
+    if (cascade) name << "cascade;";
 
     auto erase_strat = prog.get<std::string>("--dilution_strategy");
     // "random", "Zr4", "specific")
 
-    std::set<Spin*> spins_to_yeet;
-    
-
-    auto verbosity = prog.get<int>("--verbosity");
-        
-    determine_deleted_spins(name, spins_to_yeet, lat, seed, erase_strat, dilution_prob, spin_ids_to_delete);
-
-
-    if (verbosity >= 4 ){
-        cout << "Deleting spins at:\n";
-        for (auto s: spins_to_yeet) {
-            cout << s->position << "\n";
-        }
-    }
-
-
     bool save_lattice = prog.get<bool>("--save_lattice");
 
-    // Name now fully specified
-    auto statpath = outpath/(name.str()+".stats.json");
-    auto latpath = outpath/(name.str()+".lat.json");
-
-    if (!prog.get<bool>("--force")){
-        // Check if these files already exist, if so abort early
-        if ( !save_lattice && filesystem::exists(statpath)){
-            cerr << "Statfile " << statpath << "already exists" << std::endl;
-            throw std::runtime_error("Statfile exists");
-        }
-        if ( save_lattice && filesystem::exists(latpath)){
-            cerr << "latfile " << latpath << "already exists" << std::endl;
-            throw std::runtime_error("Latfile exists");
-        }
+    auto engine = prog.get<std::string>("--engine");
+    // The other engines number cells and draw dilutions differently from
+    // the reference (see deleted_links), so the same seed is a different
+    // realisation and must not share its key. They all give the same
+    // statfile for a seed, so share one name; reference names are as before.
+    if (engine != "reference") name << "engine=implicit;";
+    if (engine != "reference" && save_lattice){
+        throw std::logic_error("--save_lattice needs the reference engine");
     }
-
-    // Record the positions of the directly-diluted spins before they are
-    // erased from the lattice (their pointers are invalidated by deletion).
-    std::vector<ipos_t> deleted_spin_locs;
-    for (const auto s : spins_to_yeet){
-        deleted_spin_locs.push_back(s->position);
+    if (engine != "implicit" && block != 0){
+        throw std::logic_error("--block needs the implicit engine");
     }
-
-    std::set<Tetra*> defect_tetras;
-    del_spins_get_dtetras(lat, spins_to_yeet, defect_tetras);
-
-    lat.print_state(verbosity);
-
-      
-    
-    if (verbosity >= 3){
-        // sanity check: ensure all tetras are really defective
-        std::cout<<"Defect tetras:\n";
-        for (const auto t : defect_tetras){
-            assert(t->coboundary.size() < 4);
-            std::cout<<"[Dtetra] "<<t->position<<"\n";
-        }
+    if (block < 0){
+        throw std::invalid_argument("--block must be non-negative");
     }
-
-    if (verbosity >= 1){
-        std::cout<<"\n Finding links...\n";
+    bool save_labels = prog.get<bool>("--save_labels");
+    if (engine != "implicit" && save_labels){
+        throw std::logic_error("--save_labels needs the implicit engine");
     }
-
-    // note that link erasures are guaranteed not to delete any points.
-    vector<Tetra*> defect_tetras_vec(defect_tetras.begin(), defect_tetras.end());
-
-    unsigned total_n = defect_tetras_vec.size();
-
-    std::vector<ipos_t> deleted_link_locs;
-
-    // initialise the spins to have nullptr roots
-    for (const auto& [_, s] : lat.links){
-        s->origin = nullptr;
+    if (engine != "reference" && engine != "implicit" && prog.get<bool>("--perf")){
+        throw std::logic_error("--perf needs the reference or implicit engine");
     }
-    
-    std::map<size_t, size_t> n_dimers;
-
-    for (auto len : neighbours){
-        printf("[search] finding %d neighbours\n", len);
-        unsigned print_counter = 0ul;
-
-        n_dimers[len] = 0;
-        for (auto t1 : defect_tetras_vec){
-            auto links = find_defect_links(t1, len);
-            std::set<void*> deleted_link_ptrs;
-
-            n_dimers[len] += links.size();
-            for (auto path : links){
-                excise_path(lat, path, deleted_link_ptrs, deleted_link_locs);
-            }
-            
-            printf("%5d / %5d (%02d%%)\r", print_counter, total_n,
-                    print_counter * 100 / total_n);
-            fflush(stdout); 
-            print_counter++;
-            
+    // hardware counters, if asked for and available
+    std::optional<perf_counters::counters> perf;
+    if (prog.get<bool>("--perf")){
+        perf.emplace();
+        if (!perf->available()){
+            printf("[perf] hardware counters unavailable (%s)\n", perf->error().c_str());
+            perf.reset();
         }
-
-        printf("\n");
-    }
-    
-
-    if (save_lattice){
-        export_lattice(latpath, lat, deleted_spin_locs, deleted_link_locs);
     }
+    const perf_counters::counters* perf_ptr = perf ? &*perf : nullptr;
 
-    // Counting complete. 
-    // Finding connected components:
+    const auto sel = stats_selection::parse(stats_spec);
 
-    auto connected_links = find_connected(lat, lat.links);
-    auto connected_plaqs = find_connected(lat, lat.plaqs);
-    auto connected_vols = find_connected(lat, lat.vols);
+    if (engine == "implicit"){
+        arena::stage_timer stage(prog.get<int>("--verbosity") >= 1, perf_ptr);
+        run_implicit(name, outpath, supercell_spec, neighbours, seed,
+                erase_strat, dilution_prob, spin_ids_to_delete,
+                cascade, block, save_labels, prog.get<bool>("--force"), sel, stage);
+        return 0;
+    }
+    if (engine == "streaming"){
+        run_streaming(name, outpath, supercell_spec, neighbours, seed,
+                erase_strat, dilution_prob, prog.get<bool>("--force"), sel);
+        return 0;
+    }
+    if (engine == "replicas"){
+        run_replicas(name, outpath, supercell_spec, neighbours, seed,
+                erase_strat, dilution_prob, prog.get<bool>("--force"), sel);
+        return 0;
+    }
 
-    export_stats(statpath, lat, 
-            connected_links, connected_plaqs, connected_vols,
-            n_dimers);
+    arena::realisation_arena arena(prog.get<std::string>("--arena"));
+    arena::stage_timer stage(arena, prog.get<int>("--verbosity") >= 1, perf_ptr);
+    run_reference(name, outpath, supercell_spec, neighbours, seed,
+            erase_strat, dilution_prob, spin_ids_to_delete, cascade,
+            save_lattice, prog.get<bool>("--force"),
+            prog.get<int>("--verbosity"), sel, stage);
+    stage("teardown");
 
     return 0;
 }
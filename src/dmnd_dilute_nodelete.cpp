@@ -435,7 +435,7 @@ int main (int argc, const char *argv[]) {
     }
 
     char buf[1024];
-    snprintf(buf, 1024, "p=%.04f;seed=%llx;", dilution_prob, seed);
+    snprintf(buf, 1024, "p=%.04f;seed=%llx;", dilution_prob, (unsigned long long)seed);
     name<<buf;
 
     bool save_lattice = prog.get<bool>("--save_lattice");
@@ -0,0 +1,194 @@
+#include <argparse.hpp>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "exact_enumeration.hpp"
+#include "format_bits.hpp"
+#include "implicit_pipeline.hpp"
+#include "run_key.hpp"
+/**
+ * Exact disorder averages over every set of up to --max_deleted deleted
+ * links of a small supercell (see exact_enumeration.hpp), in place of
+ * sampling seeds. Defect paths are excised as by dmnd_dilute's implicit
+ * engine. Writes the observables summed over the sets of each size, and
+ * their averages at each --dilution_prob.
+ */
+
+using namespace std;
+using json = nlohmann::json;
+
+
+/**
+ * Averages at probability p over the sets of at most max_deleted links,
+ * and 'weight', the probability of drawing such a set; 1 - weight bounds
+ * the truncation error of an observable in [0, 1].
+ */
+json averages_at(double p, uint64_t n_links, const std::vector<std::string>& names,
+        const std::vector<exact_enumeration::sums>& by_deleted){
+    long double norm = 0;
+    std::vector<long double> acc(names.size(), 0);
+    for (size_t j=0; j<by_deleted.size(); j++){
+        const long double w = powl(p, j) * powl(1 - p, n_links - j);
+        norm += w * by_deleted[j].n_configs;
+        for (size_t i=0; i<names.size(); i++) acc[i] += w * by_deleted[j].values[i];
+    }
+
+    json res = {};
+    res["p"] = p;
+    res["weight"] = double(norm);
+    for (size_t i=0; i<names.size(); i++){
+        res[names[i]] = norm > 0 ? double(acc[i] / norm) : 0.;
+    }
+    return res;
+}
+
+
+int main (int argc, const char *argv[]) {
+
+    argparse::ArgumentParser prog(argv[0]);
+    prog.add_argument("Z1")
+        .help("First lattice vector in primitive units (three integers) ")
+        .nargs(3)
+        .scan<'i', int>();
+    prog.add_argument("Z2")
+        .help("Second lattice vector in primitive units (three integers)")
+        .nargs(3)
+        .scan<'i', int>();
+    prog.add_argument("Z3")
+        .help("Third lattice vector in primitive units (three integers)")
+        .nargs(3)
+        .scan<'i', int>();
+
+    std::string outdir;
+    prog.add_argument("--output_dir", "-o")
+        .help("Path to output")
+        .required()
+        .store_into(outdir);
+
+    prog.add_argument("--force", "-f")
+        .help("Overwrites output files")
+        .default_value(false)
+        .implicit_value(true);
+
+    std::vector<int> neighbours;
+    prog.add_argument("--neighbours", "-n")
+        .scan<'i', int>()
+        .nargs(argparse::nargs_pattern::at_least_one)
+        .store_into(neighbours);
+
+    prog.add_argument("--cascade")
+        .help("Keep searching from the defects each round of excisions creates, until there are none")
+        .default_value(false)
+        .implicit_value(true);
+
+    int max_deleted;
+    prog.add_argument("--max_deleted", "-k")
+        .help("Largest number of deleted links enumerated")
+        .required()
+        .scan<'i', int>()
+        .store_into(max_deleted);
+
+    std::vector<double> probs;
+    prog.add_argument("--dilution_prob", "-p")
+        .help("Probabilities of deleting a link to average at")
+        .default_value<std::vector<double>>({})
+        .nargs(argparse::nargs_pattern::at_least_one)
+        .scan<'g', double>()
+        .store_into(probs);
+
+    prog.add_argument("--verify")
+        .help("Also run every configuration through the full pipeline and compare")
+        .default_value(false)
+        .implicit_value(true);
+
+    try {
+        prog.parse_args(argc, argv);
+    } catch (const std::exception& err){
+        cerr << err.what() << endl;
+        cerr << prog;
+        std::exit(1);
+    }
+
+    std::filesystem::path outpath(outdir);
+    if (! filesystem::exists(outpath) ){
+        throw std::runtime_error("Cannot open outdir");
+    }
+    if (max_deleted < 0){
+        throw std::invalid_argument("--max_deleted must be non-negative");
+    }
+
+    std::stringstream name;
+    imat33_t supercell_spec;
+    name << parse_supercell_spec(supercell_spec, prog);
+    std::cout<<"Constructing supercell of dimensions \n"<<supercell_spec<<std::endl;
+
+    const auto lens = search_lengths(neighbours);
+    name << comma_separate("nn", lens);
+    bool cascade = prog.get<bool>("--cascade");
+    if (cascade) name << "cascade;";
+    name << "kmax=" << max_deleted << ";";
+
+    auto outfile = run_key::output_path(outpath, name.str(), ".exact.json");
+    if (!prog.get<bool>("--force") && filesystem::exists(outfile)){
+        cerr << "Output " << outfile << "already exists" << std::endl;
+        throw std::runtime_error("Output exists");
+    }
+
+    exact_enumeration::enumeration en(supercell_spec, lens, cascade, max_deleted,
+            prog.get<bool>("--verify"));
+    en.run();
+
+    const auto& lat = en.states[0].lat;
+    const auto names = exact_enumeration::observable_names(lens);
+
+    json j = {};
+    j["__version__"] = 1;
+    j["key"] = run_key::key_of(name.str());
+    j["params"] = run_key::params_of(name.str());
+    j["counts"] = {{"points", lat.size(0)}, {"links", lat.size(1)},
+        {"plaqs", lat.size(2)}, {"vols", lat.size(3)}};
+    j["symmetries"] = lat.sc.n_cells;
+
+    // sums over every set of j deleted links
+    j["by_deleted"] = json::array();
+    for (size_t k=0; k<en.by_deleted.size(); k++){
+        const auto& s = en.by_deleted[k];
+        json entry = {};
+        entry["n_configs"] = s.n_configs;
+        entry["n_representatives"] = s.n_representatives;
+        for (size_t i=0; i<names.size(); i++) entry[names[i]] = double(s.values[i]);
+        j["by_deleted"].push_back(entry);
+        printf("[enumerate] %zu deleted: %lu sets, %lu representatives\n",
+                k, s.n_configs, s.n_representatives);
+    }
+
+    j["averages"] = json::array();
+    for (auto p : probs){
+        if (p < 0 || p > 1) throw std::invalid_argument("Probabilities lie in [0, 1]");
+        auto avg = averages_at(p, lat.size(1), names, en.by_deleted);
+        printf("[enumerate] p=%.4f: weight %.6f, links wrap %.6f\n", p,
+                avg["weight"].get<double>(), avg["links_wrap"].get<double>());
+        j["averages"].push_back(avg);
+    }
+
+    if (prog.get<bool>("--verify")){
+        printf("[verify] %lu mismatches\n", en.n_mismatches);
+        if (en.n_mismatches) return 1;
+    }
+
+    cout<<"Saving enumeration to \n"<<outfile<<std::endl;
+    std::ofstream of(outfile);
+    of << j;
+    of.close();
+    run_key::record(outpath, name.str(), {outfile});
+
+    return 0;
+}
@@ -1,7 +1,9 @@
 #include <cstdlib>
+#include <optional>
 #include <ostream>
 #include <random>
 #include <sstream>
+#include <string>
 #include "admin/basic_parser.hh"
 #include "semiclassic_qsi.hpp"
 
@@ -60,12 +62,25 @@ int main (int argc, const char *argv[]) {
     static std::random_device dev;
     static auto rng = std::mt19937(dev());
 
-    // Run MC steps 
+    // Hardware counters of each move type, only if DMND_PERF=1 is set in
+    // the environment (the input file has no optional keys): reading them
+    // costs several syscalls per step
+    std::optional<perf_counters::counters> counters;
+    std::optional<perf_counters::accumulator> perf;
+    const char* perf_env = std::getenv("DMND_PERF");
+    if (perf_env != nullptr && std::string(perf_env) == "1"){
+        counters.emplace();
+        perf.emplace(*counters);
+    }
+
+    // Run MC steps
     unsigned num_success = 0;
     for (unsigned n=0; n<num_anneal; n++) {
-        num_success += MC::apply_step(lat, 1/T_hot, rng);
+        num_success += MC::apply_step(lat, 1/T_hot, rng,
+                counters && counters->available() ? &*perf : nullptr);
     }
     cout << "Success rate: " << num_success*100.0 / num_anneal <<std::endl;
+    if (perf) perf->report();
 
 
     return 0;
@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "dmnd.h"
+#include "geom_traverser.hpp"
+#include "implicit_diamond.hpp"
+#include "implicit_pipeline.hpp"
+
+/**
+ * Implementation of the C API in dmnd.h, over the implicit engine.
+ * Exceptions never cross the API: they are caught at every entry point and
+ * their message kept for dmnd_last_error.
+ */
+
+struct dmnd_lattice {
+    implicit_diamond lat;
+    // cluster sizes and (with keep_labels) canonical-order labels of the
+    // last realisation, per dimension
+    std::vector<uint64_t> sizes[4];
+    std::vector<uint32_t> labels[4];
+    bool has_labels = false;
+
+    dmnd_lattice(const imat33_t& Z, unsigned block) : lat(Z, block) {}
+};
+
+namespace {
+
+thread_local std::string last_error;
+
+// Runs f, turning any exception into 'fail' and a message
+template<typename F, typename R>
+R guarded(F&& f, R fail){
+    try {
+        return f();
+    } catch (const std::exception& e){
+        last_error = e.what();
+    } catch (...){
+        last_error = "Unknown error";
+    }
+    return fail;
+}
+
+void check_dim(int dim){
+    if (dim < 1 || dim > 3) throw std::out_of_range("Only links, plaqs and vols are clustered");
+}
+
+template<int dim>
+void collect(dmnd_lattice& h, bool keep_labels, dmnd_cluster_stats& out){
+    auto clusters = find_connected<dim>(h.lat);
+    auto stats = summarise_clusters(clusters, h.lat.size(dim));
+
+    out = {};
+    out.n_alive = h.lat.count_alive(dim);
+    out.n_clusters = stats.n_clusters;
+    out.largest = stats.largest;
+    out.second_largest = stats.second_largest;
+    out.P_inf = stats.P_inf;
+    out.mean_size = stats.mean_size;
+    out.largest_Rg = stats.largest_Rg;
+    out.wraps = stats.wraps;
+
+    h.sizes[dim].resize(clusters.size());
+    for (size_t i=0; i<clusters.size(); i++) h.sizes[dim][i] = clusters[i].size;
+
+    // labels are overwritten by each search, so they are copied in between
+    if (keep_labels){
+        h.labels[dim].resize(h.lat.size(dim));
+        for (uint64_t id=0; id<h.lat.size(dim); id++){
+            h.labels[dim][h.lat.canonical_id(dim, id)] = h.lat.label[id];
+        }
+    }
+}
+
+} // end anonymous namespace
+
+
+extern "C" {
+
+int dmnd_api_version(void){
+    return DMND_API_VERSION;
+}
+
+const char* dmnd_last_error(void){
+    return last_error.c_str();
+}
+
+dmnd_lattice* dmnd_lattice_new(const int64_t Z[9], unsigned block){
+    return guarded([&]{
+        if (Z == nullptr) throw std::invalid_argument("No supercell given");
+        imat33_t spec;
+        for (int i=0; i<3; i++){
+            for (int j=0; j<3; j++) spec(i,j) = Z[3*i + j];
+        }
+        return new dmnd_lattice(spec, block);
+    }, (dmnd_lattice*)nullptr);
+}
+
+void dmnd_lattice_free(dmnd_lattice* lat){
+    delete lat;
+}
+
+uint64_t dmnd_lattice_size(const dmnd_lattice* lat, int dim){
+    if (lat == nullptr || dim < 0 || dim > 3) return 0;
+    return lat->lat.size(dim);
+}
+
+int dmnd_realise(dmnd_lattice* lat, const dmnd_params* params, dmnd_result* res){
+    return guarded([&]{
+        if (lat == nullptr || params == nullptr || res == nullptr){
+            throw std::invalid_argument("Null argument");
+        }
+        static const char* strategies[] = {"random", "Zr4", "specific"};
+        if (params->strategy < DMND_RANDOM || params->strategy > DMND_SPECIFIC){
+            throw std::invalid_argument("Unknown dilution strategy");
+        }
+
+        std::vector<int> ids(params->specific_ids, params->specific_ids + params->n_specific_ids);
+        std::vector<int> neighbours(params->neighbours, params->neighbours + params->n_neighbours);
+        auto lens = search_lengths(neighbours);
+        if (!lens.empty() && lens.back() > DMND_MAX_PATH_LEN){
+            throw std::invalid_argument("Path lengths above DMND_MAX_PATH_LEN are not supported");
+        }
+
+        auto& L = lat->lat;
+        L.reset();
+        lat->has_labels = false;
+        auto links = deleted_links(L, params->seed, strategies[params->strategy],
+                params->dilution_prob, ids);
+        auto n_dimers = dilute_and_excise(L, links, lens, params->cascade != 0, false);
+
+        *res = {};
+        for (const auto& [len, c] : n_dimers.front()) res->n_dimers[len] = c;
+        res->n_generations = n_dimers.size();
+
+        const bool keep = params->keep_labels != 0;
+        collect<1>(*lat, keep, res->clusters[0]);
+        collect<2>(*lat, keep, res->clusters[1]);
+        collect<3>(*lat, keep, res->clusters[2]);
+        lat->has_labels = keep;
+        return 0;
+    }, -1);
+}
+
+int64_t dmnd_cluster_sizes(const dmnd_lattice* lat, int dim, uint64_t* buf, size_t cap){
+    return guarded([&]{
+        if (lat == nullptr) throw std::invalid_argument("Null lattice");
+        check_dim(dim);
+        const auto& sizes = lat->sizes[dim];
+        if (buf != nullptr){
+            std::copy_n(sizes.begin(), std::min(cap, sizes.size()), buf);
+        }
+        return int64_t(sizes.size());
+    }, int64_t(-1));
+}
+
+int dmnd_cluster_labels(const dmnd_lattice* lat, int dim, uint32_t* buf, size_t cap){
+    return guarded([&]{
+        if (lat == nullptr || buf == nullptr) throw std::invalid_argument("Null argument");
+        check_dim(dim);
+        if (!lat->has_labels){
+            throw std::logic_error("The last realisation did not keep labels");
+        }
+        const auto& labels = lat->labels[dim];
+        if (cap < labels.size()) throw std::length_error("Label buffer too small");
+        std::memcpy(buf, labels.data(), labels.size()*sizeof(uint32_t));
+        return 0;
+    }, -1);
+}
+
+} // extern "C"
@@ -0,0 +1,682 @@
+#include <argparse.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <sqlite3.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <XoshiroCpp.hpp>
+
+/**
+ * Finite-size-scaling analysis of the wrapping probability stored in the
+ * SQLite databases produced by scripts/merge_to_sql.py.
+ *
+ * For every system size L the wrapping probability Pi(p, L) is estimated
+ * with bootstrap error bars. Each bootstrap replicate also yields the
+ * crossing points of consecutive-L curves and a scaling collapse
+ *     Pi(p, L) = f( (p - p_c) L^{1/nu} ),
+ * so that p_c and nu come with error bars for free.
+ */
+
+using namespace nlohmann;
+using namespace std;
+
+
+// Number of wrapping samples 'k' out of 'n' realisations at a single (L, p)
+struct wrap_count {
+    double p;
+    unsigned long n = 0;
+    unsigned long k = 0;
+};
+
+// A single wrapping-probability curve, sorted by p
+struct wrap_curve {
+    long L;
+    std::vector<wrap_count> pts;
+};
+
+
+/////////////////////////////////
+/// READING THE DATABASE ////////
+
+// Parses "a,b,c" as written by comma_separate into three integers
+inline std::array<long, 3> parse_vec3(const char* s){
+    std::array<long, 3> v;
+    if (sscanf(s, "%ld,%ld,%ld", &v[0], &v[1], &v[2]) != 3){
+        throw std::runtime_error(std::string("Cannot parse supercell vector ")+s);
+    }
+    return v;
+}
+
+// Linear system size, defined as the cube root of the number of primitive cells
+inline long linear_size(const char* Z1, const char* Z2, const char* Z3){
+    auto a = parse_vec3(Z1);
+    auto b = parse_vec3(Z2);
+    auto c = parse_vec3(Z3);
+    long det = a[0]*(b[1]*c[2] - b[2]*c[1])
+             - a[1]*(b[0]*c[2] - b[2]*c[0])
+             + a[2]*(b[0]*c[1] - b[1]*c[0]);
+    return std::lround(std::cbrt(std::abs(static_cast<double>(det))));
+}
+
+// Whether the excised path lengths "a,b,..." of a run are 'nn' (sorted),
+// in whatever order the run named them
+inline bool same_lengths(const char* s, const std::vector<int>& nn){
+    std::vector<int> got;
+    std::stringstream ss(s ? s : "");
+    std::string x;
+    while (std::getline(ss, x, ',')){
+        if (!x.empty()) got.push_back(std::stoi(x));
+    }
+    std::sort(got.begin(), got.end());
+    got.erase(std::unique(got.begin(), got.end()), got.end());
+    return got == nn;
+}
+
+
+// Whether 'table' has the column 'column'; databases merged before it was
+// added to the schema lack it
+bool has_column(sqlite3* db, const std::string& table, const std::string& column){
+    sqlite3_stmt* stmt;
+    const char* query = "SELECT 1 FROM pragma_table_info(?) WHERE name = ?";
+    if (sqlite3_prepare_v2(db, query, -1, &stmt, nullptr) != SQLITE_OK){
+        throw std::runtime_error(std::string("Bad query: ")+sqlite3_errmsg(db));
+    }
+    sqlite3_bind_text(stmt, 1, table.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, column.c_str(), -1, SQLITE_TRANSIENT);
+    const bool res = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+
+/**
+ * The wrapping curves of the runs in 'table' that excised the path
+ * lengths 'nn' (sorted), with or without --cascade: runs that differ in
+ * either are different systems, and are never pooled.
+ */
+std::vector<wrap_curve> load_curves(
+        const std::filesystem::path& db_path,
+        const std::string& table,
+        const std::string& observable,
+        const std::vector<int>& nn,
+        bool cascade
+        ){
+    sqlite3* db;
+    if (sqlite3_open_v2(db_path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK){
+        std::string msg = sqlite3_errmsg(db);
+        sqlite3_close(db);
+        throw std::runtime_error("Cannot open database: "+msg);
+    }
+
+    // runs merged before --cascade existed did not use it
+    const std::string cascade_column = has_column(db, table, "cascade") ? "cascade" : "0";
+
+    // table and column names cannot be bound as parameters; both are
+    // restricted to argparse choices by the caller.
+    std::string query = "SELECT Z1, Z2, Z3, nn, p, SUM("+observable+"), COUNT(*) FROM "
+        + table + " WHERE " + observable + " IS NOT NULL AND " + cascade_column + " = ?"
+        + " GROUP BY Z1, Z2, Z3, nn, p";
+
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK){
+        std::string msg = sqlite3_errmsg(db);
+        sqlite3_close(db);
+        throw std::runtime_error("Bad query: "+msg);
+    }
+    sqlite3_bind_int(stmt, 1, cascade ? 1 : 0);
+
+    // Different supercell shapes with the same volume are pooled
+    std::map<long, std::map<double, wrap_count>> by_L;
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW){
+        // nn is compared here rather than in the query, as older runs did
+        // not sort it
+        if (!same_lengths(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3)), nn)){
+            continue;
+        }
+        auto L = linear_size(
+                reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+                reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)),
+                reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2)));
+        double p = sqlite3_column_double(stmt, 4);
+        auto& c = by_L[L][p];
+        c.p = p;
+        c.k += sqlite3_column_int64(stmt, 5);
+        c.n += sqlite3_column_int64(stmt, 6);
+    }
+    if (rc != SQLITE_DONE){
+        std::string msg = sqlite3_errmsg(db);
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        throw std::runtime_error("Error reading database: "+msg);
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+
+    std::vector<wrap_curve> curves;
+    for (const auto& [L, pmap] : by_L){
+        curves.push_back({L, {}});
+        for (const auto& [_, c] : pmap){
+            curves.back().pts.push_back(c);
+        }
+    }
+    return curves;
+}
+
+
+/////////////////////////////////
+/// CROSSINGS ///////////////////
+
+// Locates the crossing of curves y1 and y2 sampled at the same x-values.
+// Of all sign changes of y2-y1, the steepest is taken (the tails where both
+// curves are saturated at 0 or 1 produce spurious zeros).
+// Returns NAN if the curves do not cross.
+inline double find_crossing(
+        const std::vector<double>& x,
+        const std::vector<double>& y1,
+        const std::vector<double>& y2){
+    double best = NAN;
+    double best_slope = 0;
+    for (size_t i=0; i+1<x.size(); i++){
+        double d0 = y2[i] - y1[i];
+        double d1 = y2[i+1] - y1[i+1];
+        if (d0 == 0 && d1 == 0) continue;
+        if ((d0 < 0) == (d1 < 0) && d0 != 0 && d1 != 0) continue;
+        double slope = std::abs(d1 - d0);
+        if (slope > best_slope){
+            best_slope = slope;
+            best = x[i] - d0 * (x[i+1] - x[i]) / (d1 - d0);
+        }
+    }
+    return best;
+}
+
+// The p-values sampled at both sizes, and the indices at which they occur
+struct common_grid {
+    std::vector<double> p;
+    std::vector<size_t> i1;
+    std::vector<size_t> i2;
+};
+
+inline common_grid intersect_grids(const wrap_curve& c1, const wrap_curve& c2){
+    common_grid g;
+    size_t i=0, j=0;
+    while (i < c1.pts.size() && j < c2.pts.size()){
+        if (c1.pts[i].p < c2.pts[j].p) { i++; }
+        else if (c2.pts[j].p < c1.pts[i].p) { j++; }
+        else {
+            g.p.push_back(c1.pts[i].p);
+            g.i1.push_back(i++);
+            g.i2.push_back(j++);
+        }
+    }
+    return g;
+}
+
+
+/////////////////////////////////
+/// SCALING COLLAPSE ////////////
+
+struct collapse_fit {
+    double pc = NAN;
+    double nu = NAN;
+    double chi2_dof = NAN;
+};
+
+// Solves the (small, dense) linear system A x = b in place by Gaussian
+// elimination with partial pivoting. Returns false if A is singular.
+inline bool solve_dense(std::vector<double>& A, std::vector<double>& b, size_t n){
+    for (size_t col=0; col<n; col++){
+        size_t piv = col;
+        for (size_t r=col+1; r<n; r++){
+            if (std::abs(A[r*n+col]) > std::abs(A[piv*n+col])) piv = r;
+        }
+        if (std::abs(A[piv*n+col]) < 1e-300) return false;
+        if (piv != col){
+            for (size_t c=0; c<n; c++) std::swap(A[piv*n+c], A[col*n+c]);
+            std::swap(b[piv], b[col]);
+        }
+        for (size_t r=col+1; r<n; r++){
+            double f = A[r*n+col] / A[col*n+col];
+            for (size_t c=col; c<n; c++) A[r*n+c] -= f*A[col*n+c];
+            b[r] -= f*b[col];
+        }
+    }
+    for (size_t r=n; r-- > 0;){
+        for (size_t c=r+1; c<n; c++) b[r] -= A[r*n+c]*b[c];
+        b[r] /= A[r*n+r];
+    }
+    return true;
+}
+
+/**
+ * Quality of the collapse for a trial (pc, nu): all points are mapped to
+ * x = (p-pc) L^{1/nu} and fitted by a single polynomial of degree 'deg'.
+ * Returns the weighted chi^2 per degree of freedom.
+ * Only points with window_lo < Pi < window_hi enter, since the saturated
+ * tails carry no information about the scaling function.
+ */
+inline double collapse_chi2(
+        const std::vector<wrap_curve>& curves,
+        const std::vector<std::vector<double>>& y,
+        double pc, double nu, unsigned deg,
+        double window_lo, double window_hi){
+    if (nu <= 0) return INFINITY;
+    const size_t m = deg+1;
+    std::vector<double> xs, ys, ws;
+    for (size_t c=0; c<curves.size(); c++){
+        double Lfac = std::pow(static_cast<double>(curves[c].L), 1.0/nu);
+        for (size_t i=0; i<curves[c].pts.size(); i++){
+            double yi = y[c][i];
+            if (yi <= window_lo || yi >= window_hi) continue;
+            // binomial variance, regularised away from the boundaries
+            double var = (yi*(1-yi) + 1e-3) / curves[c].pts[i].n;
+            xs.push_back((curves[c].pts[i].p - pc) * Lfac);
+            ys.push_back(yi);
+            ws.push_back(1/var);
+        }
+    }
+    if (xs.size() <= m + 2) return INFINITY;
+
+    // normal equations for the weighted polynomial fit
+    std::vector<double> A(m*m, 0.0), b(m, 0.0), pw(2*m);
+    for (size_t i=0; i<xs.size(); i++){
+        pw[0] = 1;
+        for (size_t k=1; k<2*m; k++) pw[k] = pw[k-1]*xs[i];
+        for (size_t r=0; r<m; r++){
+            b[r] += ws[i]*ys[i]*pw[r];
+            for (size_t c=0; c<m; c++) A[r*m+c] += ws[i]*pw[r+c];
+        }
+    }
+    if (!solve_dense(A, b, m)) return INFINITY;
+
+    double chi2 = 0;
+    for (size_t i=0; i<xs.size(); i++){
+        double f = 0;
+        for (size_t k=m; k-- > 0;) f = f*xs[i] + b[k];
+        chi2 += ws[i]*(f-ys[i])*(f-ys[i]);
+    }
+    return chi2 / (xs.size() - m - 2);
+}
+
+// Nelder-Mead minimisation of collapse_chi2 over (pc, nu)
+inline collapse_fit fit_collapse(
+        const std::vector<wrap_curve>& curves,
+        const std::vector<std::vector<double>>& y,
+        double pc0, double nu0, unsigned deg,
+        double window_lo, double window_hi,
+        unsigned max_iter=400){
+    auto f = [&](const std::array<double,2>& v){
+        return collapse_chi2(curves, y, v[0], v[1], deg, window_lo, window_hi);
+    };
+
+    std::array<std::array<double,2>,3> s = {{
+        {pc0, nu0}, {pc0*1.05 + 1e-3, nu0}, {pc0, nu0*1.1}
+    }};
+    std::array<double,3> fs = {f(s[0]), f(s[1]), f(s[2])};
+
+    for (unsigned it=0; it<max_iter; it++){
+        // order vertices best to worst
+        std::array<int,3> o = {0,1,2};
+        std::sort(o.begin(), o.end(), [&](int a, int b){ return fs[a] < fs[b]; });
+        auto best = s[o[0]], mid = s[o[1]], worst = s[o[2]];
+        double fb = fs[o[0]], fm = fs[o[1]], fw = fs[o[2]];
+        s = {best, mid, worst};
+        fs = {fb, fm, fw};
+
+        if (std::abs(fw - fb) <= 1e-10 * (std::abs(fb) + 1e-10)) break;
+
+        std::array<double,2> cen = {(best[0]+mid[0])/2, (best[1]+mid[1])/2};
+        auto along = [&](double t){
+            return std::array<double,2>{cen[0] + t*(worst[0]-cen[0]),
+                                        cen[1] + t*(worst[1]-cen[1])};
+        };
+
+        auto xr = along(-1); double fr = f(xr);
+        if (fr < fb){
+            auto xe = along(-2); double fe = f(xe);
+            if (fe < fr) { s[2] = xe; fs[2] = fe; }
+            else         { s[2] = xr; fs[2] = fr; }
+        } else if (fr < fm){
+            s[2] = xr; fs[2] = fr;
+        } else {
+            auto xc = along(fr < fw ? -0.5 : 0.5); double fc = f(xc);
+            if (fc < std::min(fr, fw)){
+                s[2] = xc; fs[2] = fc;
+            } else {
+                // shrink towards the best vertex
+                for (int k=1; k<3; k++){
+                    s[k] = {(s[k][0]+best[0])/2, (s[k][1]+best[1])/2};
+                    fs[k] = f(s[k]);
+                }
+            }
+        }
+    }
+    auto ib = std::min_element(fs.begin(), fs.end()) - fs.begin();
+    return {s[ib][0], s[ib][1], fs[ib]};
+}
+
+
+/////////////////////////////////
+/// BOOTSTRAP ///////////////////
+
+struct analysis_opts {
+    unsigned n_boot;
+    unsigned n_threads;
+    uint64_t seed;
+    unsigned deg;
+    double nu0;
+    double window_lo;
+    double window_hi;
+};
+
+// Everything measured on one (real or resampled) data set
+struct replicate {
+    std::vector<std::vector<double>> y;  // y[curve][point]
+    std::vector<double> crossings;       // between curve i and i+1
+    collapse_fit fit;
+};
+
+inline replicate analyse_replicate(
+        const std::vector<wrap_curve>& curves,
+        const std::vector<common_grid>& grids,
+        std::vector<std::vector<double>>&& y,
+        const analysis_opts& opt){
+    replicate r;
+    r.y = std::move(y);
+
+    std::vector<double> y1, y2;
+    for (size_t c=0; c+1<curves.size(); c++){
+        const auto& g = grids[c];
+        y1.resize(g.p.size());
+        y2.resize(g.p.size());
+        for (size_t i=0; i<g.p.size(); i++){
+            y1[i] = r.y[c][g.i1[i]];
+            y2[i] = r.y[c+1][g.i2[i]];
+        }
+        r.crossings.push_back(find_crossing(g.p, y1, y2));
+    }
+
+    // seed the collapse fit from the crossings where possible
+    double pc0 = 0; unsigned n_pc = 0;
+    for (auto x : r.crossings){
+        if (!std::isnan(x)) { pc0 += x; n_pc++; }
+    }
+    if (n_pc > 0) {
+        pc0 /= n_pc;
+    } else {
+        pc0 = curves.front().pts[curves.front().pts.size()/2].p;
+    }
+    r.fit = fit_collapse(curves, r.y, pc0, opt.nu0, opt.deg,
+            opt.window_lo, opt.window_hi);
+    return r;
+}
+
+// Resampling n Bernoulli outcomes with k successes is the same as drawing
+// from Binomial(n, k/n), so each resample costs O(1) per (L, p) point.
+inline std::vector<std::vector<double>> resample(
+        const std::vector<wrap_curve>& curves,
+        XoshiroCpp::Xoshiro256PlusPlus& gen){
+    std::vector<std::vector<double>> y(curves.size());
+    for (size_t c=0; c<curves.size(); c++){
+        for (const auto& pt : curves[c].pts){
+            std::binomial_distribution<unsigned long> B(pt.n, double(pt.k)/pt.n);
+            y[c].push_back(double(B(gen)) / pt.n);
+        }
+    }
+    return y;
+}
+
+std::vector<replicate> run_bootstrap(
+        const std::vector<wrap_curve>& curves,
+        const std::vector<common_grid>& grids,
+        const analysis_opts& opt){
+    std::vector<replicate> reps(opt.n_boot);
+
+    std::vector<std::thread> workers;
+    XoshiroCpp::Xoshiro256PlusPlus gen(opt.seed);
+    for (unsigned t=0; t<opt.n_threads; t++){
+        // non-overlapping streams: each worker starts 2^128 draws further on
+        workers.emplace_back([&, t, gen](){
+            auto my_gen = gen;
+            for (unsigned b=t; b<opt.n_boot; b += opt.n_threads){
+                reps[b] = analyse_replicate(curves, grids, resample(curves, my_gen), opt);
+            }
+        });
+        gen.jump();
+    }
+    for (auto& w : workers) w.join();
+    return reps;
+}
+
+// mean and standard deviation of the non-NAN entries
+inline std::pair<double, double> mean_std(const std::vector<double>& x){
+    double s=0, s2=0; unsigned n=0;
+    for (auto v : x){
+        if (std::isnan(v)) continue;
+        s += v; s2 += v*v; n++;
+    }
+    if (n == 0) return {NAN, NAN};
+    double m = s/n;
+    return {m, n>1 ? std::sqrt(std::max(0.0, (s2 - n*m*m)/(n-1))) : 0.0};
+}
+
+
+/////////////////////////////////
+/// EXPORTING ///////////////////
+
+json analysis_to_json(
+        const std::vector<wrap_curve>& curves,
+        const replicate& central,
+        const std::vector<replicate>& reps,
+        const analysis_opts& opt){
+    json j = {};
+    j["n_boot"] = opt.n_boot;
+
+    std::vector<double> buf(reps.size());
+    j["curves"] = json::array();
+    for (size_t c=0; c<curves.size(); c++){
+        json jc = {};
+        jc["L"] = curves[c].L;
+        for (size_t i=0; i<curves[c].pts.size(); i++){
+            for (size_t b=0; b<reps.size(); b++) buf[b] = reps[b].y[c][i];
+            jc["p"].push_back(curves[c].pts[i].p);
+            jc["n"].push_back(curves[c].pts[i].n);
+            jc["wrap_prob"].push_back(central.y[c][i]);
+            jc["wrap_prob_err"].push_back(mean_std(buf).second);
+        }
+        j["curves"].push_back(jc);
+    }
+
+    j["crossings"] = json::array();
+    for (size_t c=0; c<central.crossings.size(); c++){
+        unsigned found = 0;
+        for (size_t b=0; b<reps.size(); b++){
+            buf[b] = reps[b].crossings[c];
+            if (!std::isnan(buf[b])) found++;
+        }
+        auto [m, s] = mean_std(buf);
+        json jx = {};
+        jx["L1"] = curves[c].L;
+        jx["L2"] = curves[c+1].L;
+        jx["p_cross"] = central.crossings[c];
+        jx["p_cross_boot_mean"] = m;
+        jx["p_cross_err"] = s;
+        jx["frac_found"] = double(found)/std::max<size_t>(reps.size(), 1);
+        j["crossings"].push_back(jx);
+    }
+
+    json jf = {};
+    jf["pc"] = central.fit.pc;
+    jf["nu"] = central.fit.nu;
+    jf["chi2_dof"] = central.fit.chi2_dof;
+    for (size_t b=0; b<reps.size(); b++) buf[b] = reps[b].fit.pc;
+    jf["pc_err"] = mean_std(buf).second;
+    for (size_t b=0; b<reps.size(); b++) buf[b] = reps[b].fit.nu;
+    jf["nu_err"] = mean_std(buf).second;
+    jf["poly_degree"] = opt.deg;
+    jf["window"] = {opt.window_lo, opt.window_hi};
+    j["collapse"] = jf;
+
+    return j;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+/// MAIN PROGRAM
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+int main (int argc, const char *argv[]) {
+
+    argparse::ArgumentParser prog(argv[0]);
+
+    std::string db_path;
+    prog.add_argument("db")
+        .help("SQLite database produced by scripts/merge_to_sql.py")
+        .store_into(db_path);
+
+    prog.add_argument("--table", "-t")
+        .choices("stats_random", "stats_Zr")
+        .default_value("stats_random");
+
+    prog.add_argument("--observable", "-O")
+        .help("Wrapping flag to analyse")
+        .choices("links_wrap", "plaqs_wrap", "vols_wrap")
+        .default_value("links_wrap");
+
+    std::vector<int> nn;
+    prog.add_argument("--neighbours", "-n")
+        .help("Path lengths the runs excised, as dmnd_dilute -n (default: none)")
+        .scan<'i', int>()
+        .nargs(argparse::nargs_pattern::at_least_one)
+        .store_into(nn);
+
+    prog.add_argument("--cascade")
+        .help("Analyse the runs made with --cascade")
+        .default_value(false)
+        .implicit_value(true);
+
+    std::string outfile;
+    prog.add_argument("--output", "-o")
+        .help("Path to output JSON (default: print to stdout)")
+        .default_value(std::string(""))
+        .store_into(outfile);
+
+    prog.add_argument("--n_boot", "-b")
+        .help("Number of bootstrap replicates")
+        .scan<'i', int>()
+        .default_value(1000);
+
+    prog.add_argument("--threads", "-j")
+        .help("Worker threads (default: all hardware threads)")
+        .scan<'i', int>()
+        .default_value(0);
+
+    std::string seed_s = "0";
+    prog.add_argument("--seed", "-s")
+        .help("64-bit int to seed the RNG")
+        .store_into(seed_s);
+
+    prog.add_argument("--poly_degree")
+        .help("Degree of the polynomial scaling function")
+        .scan<'i', int>()
+        .default_value(3);
+
+    prog.add_argument("--nu0")
+        .help("Initial guess for the correlation length exponent")
+        .scan<'g', double>()
+        .default_value(0.88);
+
+    prog.add_argument("--window")
+        .help("Only points with lo < Pi < hi enter the collapse")
+        .nargs(2)
+        .scan<'g', double>()
+        .default_value(std::vector<double>{0.05, 0.95});
+
+    try {
+        prog.parse_args(argc, argv);
+    } catch (const std::exception& err){
+        cerr << err.what() << endl;
+        cerr << prog;
+        std::exit(1);
+    }
+
+    analysis_opts opt;
+    opt.n_boot = prog.get<int>("--n_boot");
+    opt.n_threads = prog.get<int>("--threads");
+    if (opt.n_threads == 0) opt.n_threads = std::max(1u, std::thread::hardware_concurrency());
+    opt.deg = prog.get<int>("--poly_degree");
+    opt.nu0 = prog.get<double>("--nu0");
+    auto window = prog.get<std::vector<double>>("--window");
+    opt.window_lo = window[0];
+    opt.window_hi = window[1];
+
+    std::stringstream ss;
+    ss << std::hex << seed_s;
+    ss >> opt.seed;
+
+    std::sort(nn.begin(), nn.end());
+    nn.erase(std::unique(nn.begin(), nn.end()), nn.end());
+    auto curves = load_curves(db_path,
+            prog.get<std::string>("--table"),
+            prog.get<std::string>("--observable"),
+            nn, prog.get<bool>("--cascade"));
+
+    if (curves.empty()){
+        cerr << "No data found in " << db_path << endl;
+        return 1;
+    }
+
+    for (const auto& c : curves){
+        unsigned long n=0;
+        for (const auto& pt : c.pts) n += pt.n;
+        cerr << "L=" << c.L << ": " << c.pts.size() << " p-values, "
+             << n << " samples\n";
+    }
+
+    std::vector<common_grid> grids;
+    for (size_t c=0; c+1<curves.size(); c++){
+        grids.push_back(intersect_grids(curves[c], curves[c+1]));
+    }
+
+    std::vector<std::vector<double>> y0(curves.size());
+    for (size_t c=0; c<curves.size(); c++){
+        for (const auto& pt : curves[c].pts) y0[c].push_back(double(pt.k)/pt.n);
+    }
+    auto central = analyse_replicate(curves, grids, std::move(y0), opt);
+
+    cerr << "Bootstrapping " << opt.n_boot << " replicates on "
+         << opt.n_threads << " threads" << endl;
+    auto reps = run_bootstrap(curves, grids, opt);
+
+    auto j = analysis_to_json(curves, central, reps, opt);
+    j["nn"] = nn;
+    j["cascade"] = prog.get<bool>("--cascade");
+
+    cerr << "p_c = " << j["collapse"]["pc"] << " +/- " << j["collapse"]["pc_err"]
+         << ", nu = " << j["collapse"]["nu"] << " +/- " << j["collapse"]["nu_err"]
+         << endl;
+
+    if (outfile.empty()){
+        cout << j.dump(2) << endl;
+    } else {
+        std::ofstream of(outfile);
+        of << j;
+        of.close();
+    }
+
+    return 0;
+}
@@ -89,11 +89,22 @@ namespace MC {
 	}
 
 
-	unsigned apply_step(sc_QSI& lat, double beta, std::mt19937& rng){
+	unsigned apply_step(sc_QSI& lat, double beta, std::mt19937& rng,
+			perf_counters::accumulator* perf){
 		unsigned success=0;
+		if (perf) perf->begin();
 		apply_tetra_gauge(lat, rng);
+		if (perf) {
+			perf->end("gauge", lat.points.size());
+			perf->begin();
+		}
 		success += apply_angle(lat, beta, rng);
+		if (perf) {
+			perf->end("angle", lat.links.size());
+			perf->begin();
+		}
 		success += apply_ring_Ising(lat, beta, rng);
+		if (perf) perf->end("ring_Ising", lat.plaqs.size());
 		return success;
 	}
 
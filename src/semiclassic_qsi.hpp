@@ -2,6 +2,7 @@
 #include "struct/cell_geometry.hpp"
 #include "struct/chain.hpp"
 #include "struct/preset_cellspecs.hpp"
+#include "perf_counters.hpp"
 #include <complex>
 #include <vector>
 #include <random>
@@ -77,6 +78,9 @@ namespace MC {
 
     unsigned apply_ring_Ising(sc_QSI& lat, double beta, std::mt19937&rng);
  
-	unsigned apply_step(sc_QSI& lat, double beta, std::mt19937& rng);
+    // One of each move; 'perf', if given, accumulates the hardware counters
+    // of each move type per cell it updates
+	unsigned apply_step(sc_QSI& lat, double beta, std::mt19937& rng,
+			perf_counters::accumulator* perf=nullptr);
 }; // end namespace MC
 